@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace kyfoo {
+
+// Bump allocator for short-lived objects that die together. Objects with
+// destructors are destroyed in reverse order when the arena rewinds past
+// them; memory is kept for reuse until the arena itself goes away.
+class Arena
+{
+public:
+    struct Mark
+    {
+        std::size_t block;
+        std::size_t offset;
+        std::size_t destructors;
+    };
+
+public:
+    explicit Arena(std::size_t blockSize = 64 * 1024);
+    ~Arena();
+
+    Arena(Arena const&) = delete;
+    void operator = (Arena const&) = delete;
+
+public:
+    void* allocate(std::size_t size, std::size_t alignment);
+
+    template <typename T, typename... Args>
+    T* create(Args&&... args)
+    {
+        auto p = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if ( !std::is_trivially_destructible<T>::value )
+            myDestructors.push_back({ p, [](void* q) { static_cast<T*>(q)->~T(); } });
+
+        return p;
+    }
+
+    Mark mark() const
+    {
+        return { myBlock, myOffset, myDestructors.size() };
+    }
+
+    void rewind(Mark const& mark);
+    void reset();
+
+    // Bytes held in blocks, used or not
+    std::size_t capacity() const;
+
+private:
+    struct Block
+    {
+        std::unique_ptr<char[]> data;
+        std::size_t size;
+    };
+
+    struct Destructor
+    {
+        void* object;
+        void (*destroy)(void*);
+    };
+
+    std::size_t myBlockSize;
+    std::vector<Block> myBlocks;
+    std::size_t myBlock = 0;
+    std::size_t myOffset = 0;
+    std::vector<Destructor> myDestructors;
+};
+
+} // namespace kyfoo
@@ -42,6 +42,12 @@ public:
     {
     }
 
+    Slice(T const* data, std::size_t len)
+        : myData(const_cast<T*>(data))
+        , myLength(len)
+    {
+    }
+
 public:
     T const& operator [] (std::size_t index) const
     {
@@ -67,12 +73,6 @@ public:
     std::size_t size() const { return myLength; }
 
 private:
-    Slice(T* data, std::size_t len)
-        : myData(data)
-        , myLength(len)
-    {
-    }
-
     T* myData = nullptr;
     std::size_t myLength = 0;
 };
@@ -98,6 +98,13 @@ public:
     void resolveExpression(std::unique_ptr<Expression>& expression);
     void resolveExpressions(std::vector<std::unique_ptr<Expression>>& expressions);
 
+    // As above, also recording the canonical node of each concrete type
+    void resolveType(std::unique_ptr<Expression>& type);
+    void resolveTypes(std::vector<std::unique_ptr<Expression>>& types);
+
+private:
+    void canonicalize(Expression& expression);
+
 private:
     Diagnostics* myDiagnostics;
     IResolver* myResolver;
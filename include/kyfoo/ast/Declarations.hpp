@@ -269,6 +269,9 @@ public:
     Expression* constraint();
     Expression const* constraint() const;
 
+    Expression* initialization();
+    Expression const* initialization() const;
+
 protected:
     std::unique_ptr<Expression> myConstraint;
     std::unique_ptr<Expression> myInitialization;
@@ -385,7 +388,7 @@ public:
 class SymbolVariable : public Declaration
 {
 public:
-    SymbolVariable(Symbol& parent, std::string const& name);
+    SymbolVariable(Symbol& parent, lexer::Token const& identifier);
 
 protected:
     SymbolVariable(SymbolVariable const& rhs);
@@ -409,14 +412,13 @@ public:
 
 public:
     Symbol const& parent() const;
-    std::string const& name() const;
+    std::string_view name() const;
 
     void bindExpression(Expression const* expr);
     Expression const* boundExpression() const;
 
 private:
     Symbol* myParent = nullptr;
-    std::string myName;
     Expression const* myBoundExpression = nullptr;
 };
 
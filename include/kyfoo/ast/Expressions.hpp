@@ -28,6 +28,7 @@ class Expression : public INode
 {
 public:
     friend class Context;
+    friend class TypeTable;
 
     enum class Kind
     {
@@ -67,6 +68,10 @@ public:
     Kind kind() const;
     Declaration const* declaration() const;
 
+    // Canonical node of a resolved concrete type in type position (see
+    // Context::resolveType), null otherwise
+    Expression const* canonical() const;
+
     Slice<Expression*> constraints();
     const Slice<Expression*> constraints() const;
 
@@ -79,6 +84,9 @@ private:
 protected:
     std::vector<std::unique_ptr<Expression>> myConstraints;
     Declaration const* myDeclaration = nullptr;
+
+private:
+    Expression const* myCanonical = nullptr;
 };
 
 class PrimaryExpression : public Expression
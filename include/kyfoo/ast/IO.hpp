@@ -52,7 +52,7 @@ public:
     PRIMITIVE_TYPES(X);
 #undef X
 
-    virtual void next(const char* name, std::string const& string) = 0;
+    virtual void next(const char* name, std::string_view string) = 0;
     virtual void next(const char* name, const char* string) = 0;
     virtual void next(const char* name, IIO const& io) = 0;
     virtual void next(const char* name, IIO const* io) = 0;
@@ -145,9 +145,11 @@ public:
     PRIMITIVE_TYPES(X)
 #undef X
 
-    void next(const char* name, std::string const& string) override
+    void next(const char* name, std::string_view string) override
     {
-        next(name, string.c_str());
+        newLine();
+        key(name);
+        *myStream << std::quoted(string);
     }
 
     void next(const char* name, const char* string) override
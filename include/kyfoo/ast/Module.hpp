@@ -1,18 +1,30 @@
 #pragma once
 
+#include <atomic>
 #include <filesystem>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include <kyfoo/Slice.hpp>
+#include <kyfoo/lexer/Token.hpp>
 #include <kyfoo/ast/Node.hpp>
 
 namespace kyfoo {
 
+    class Arena;
     class Diagnostics;
 
     namespace lexer {
+        class InternTable;
         class Scanner;
+        class SourceBuffer;
+    }
+
+    namespace parser {
+        enum class GrammarKind;
     }
 
     namespace ast {
@@ -21,7 +33,9 @@ class Declaration;
 class DeclarationScope;
 class Module;
 class AxiomsModule;
+class TypeTable;
 
+// Modules may be created and found from several threads at once
 class ModuleSet
 {
 public:
@@ -40,13 +54,37 @@ public:
     AxiomsModule* axioms();
     AxiomsModule const* axioms() const;
 
+    lexer::InternTable& internTable();
+    lexer::InternTable const& internTable() const;
+
+    // Grammar used to parse the set's modules
+    parser::GrammarKind grammar() const;
+    void setGrammar(parser::GrammarKind grammar);
+
+    // Arena for AST nodes made during semantics, released with the set. Any
+    // module's semantics may add nodes to another's scopes.
+    Arena* createArena();
+
+    // Canonical concrete types shared by the set's modules
+    TypeTable& types() const;
+
 private:
     std::unique_ptr<AxiomsModule> createAxiomsModule();
 
+    // Require myMutex
+    Module* lookup(std::string const& name);
+    Module* lookup(std::experimental::filesystem::path const& normalPath);
+
 private:
+    // Arenas are declared first so that they outlive every module's nodes
+    std::unique_ptr<lexer::InternTable> myInternTable;
+    std::mutex myMutex;
+    std::vector<std::unique_ptr<Arena>> myArenas;
+    std::unique_ptr<TypeTable> myTypes;
     std::unique_ptr<AxiomsModule> myAxioms;
     std::vector<std::unique_ptr<Module>> myModules;
     std::vector<Module*> myImpliedImports;
+    parser::GrammarKind myGrammar{};
 };
 
 class Module : public INode
@@ -67,8 +105,22 @@ public:
     std::experimental::filesystem::path const& path() const;
 
 public:
-    void parse(Diagnostics& dgn);
-    void parse(Diagnostics& dgn, std::istream& stream);
+    // Large sources are parsed in chunks on up to concurrency threads
+    void parse(Diagnostics& dgn, unsigned concurrency = 1);
+    void parse(Diagnostics& dgn, std::unique_ptr<lexer::SourceBuffer> source, unsigned concurrency = 1);
+
+    // Replaces [first, last) of the source with text, rescanning and
+    // reparsing only the top-level declarations the edit touches. Falls back
+    // to a full parse of the edited text when the region has errors. Only
+    // valid before semantic analysis.
+    //
+    // Replaced declarations keep their arena memory until the next full
+    // parse. Once the parse arenas have doubled since then, the next edit
+    // parses the module from scratch to release it.
+    void reparse(Diagnostics& dgn,
+                 lexer::source_offset_t first,
+                 lexer::source_offset_t last,
+                 std::string_view text);
 
     void resolveImports(Diagnostics& dgn);
     void semantics(Diagnostics& dgn);
@@ -76,9 +128,19 @@ public:
     Module const* import(Module* module);
     Module const* import(Diagnostics& dgn, lexer::Token const& token);
 
+    // Other modules analyzed at the same time may instantiate this module's
+    // templates
     void appendTemplateInstance(Declaration const* instance);
 
+    // Changes whenever one of the module's scopes gains a symbol set or the
+    // module gains an import, invalidating cached lookups
+    std::size_t symbolGeneration() const;
+    void symbolsChanged();
+
 public:
+    ModuleSet* moduleSet();
+    ModuleSet const* moduleSet() const;
+
     AxiomsModule* axioms();
     AxiomsModule const* axioms() const;
 
@@ -91,14 +153,50 @@ public:
 
     Slice<Declaration const*> templateInstantiations() const;
 
+private:
+    // Source text of one top-level declaration, from its line at indent
+    // zero up to the next
+    struct SourceSpan
+    {
+        lexer::source_offset_t first;
+        lexer::source_offset_t last;
+        lexer::source_id_t scanned;             // buffer its tokens refer to
+        lexer::source_offset_t scannedFirst;    // where first was in that buffer
+    };
+
+    // Arena for this module's nodes made during semantics
+    Arena& arena();
+
+    // Arena for nodes made by the current parse, released by the next one
+    Arena& createParseArena();
+    std::size_t parseArenaSize() const;
+
+    bool parseChunks(unsigned concurrency);
+    void parseDeclarations(Diagnostics& dgn, lexer::Scanner& scanner, DeclarationScope& scope);
+    bool spanDeclarations(std::vector<lexer::Token> const& tokens,
+                          lexer::source_offset_t first,
+                          lexer::source_offset_t last,
+                          lexer::source_id_t source,
+                          std::size_t declarations,
+                          std::vector<SourceSpan>& spans) const;
+    void forwardRetiredSources();
+
 private:
     ModuleSet* myModuleSet = nullptr;
+    Arena* myArena = nullptr;
     std::experimental::filesystem::path myPath;
     std::string myName;
+    std::vector<std::unique_ptr<Arena>> myParseArenas;    // outlive myScope
+    std::size_t myParsedSize = 0;                           // parse arenas after the last full parse
+    std::unique_ptr<lexer::SourceBuffer> mySource;
+    std::vector<std::unique_ptr<lexer::SourceBuffer>> myRetiredSources;
+    std::vector<SourceSpan> mySpans;
     std::unique_ptr<DeclarationScope> myScope;
+    std::mutex myTemplateInstancesMutex;
     std::vector<Declaration const*> myTemplateInstantiations;
 
     std::vector<Module*> myImports;
+    std::atomic<std::size_t> mySymbolGeneration{ 0 };
 };
 
     } // namespace ast
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <type_traits>
-#include <map>
+#include <vector>
 
 #include <kyfoo/ast/IO.hpp>
 
@@ -57,15 +60,122 @@
     void type::remapReferences(clone_map_t const&) {}
 
 namespace kyfoo {
+    class Arena;
+
     namespace ast {
 
+// Nodes made while a NodeArenaScope is active on the thread come from its
+// arena, and deleting one only runs its destructor. The memory is released
+// with the arena, which ModuleSet keeps until all of its modules are gone.
 class INode : public IIO
 {
 public:
     virtual ~INode() = default;
+
+public:
+    static void* operator new(std::size_t size);
+    static void operator delete(void* p);
+};
+
+class NodeArenaScope
+{
+public:
+    explicit NodeArenaScope(Arena& arena);
+    ~NodeArenaScope();
+
+    NodeArenaScope(NodeArenaScope const&) = delete;
+    void operator = (NodeArenaScope const&) = delete;
+
+private:
+    Arena* myPrevious = nullptr;
 };
 
-using clone_map_t = std::map<void const*, void*>;
+// Maps each node visited by a clone to its copy, so references into the
+// cloned tree can be redirected. Open addressing with linear probing; keys
+// are never removed.
+class CloneMap
+{
+public:
+    // Sized so that expected entries fit without growing
+    explicit CloneMap(std::size_t expected = 0)
+    {
+        std::size_t capacity = 16;
+        while ( capacity < expected * 2 )
+            capacity *= 2;
+
+        resize(capacity);
+    }
+
+public:
+    void*& operator [] (void const* key)
+    {
+        auto i = slot(key);
+        while ( myEntries[i].key ) {
+            if ( myEntries[i].key == key )
+                return myEntries[i].value;
+
+            i = (i + 1) & myMask;
+        }
+
+        if ( (mySize + 1) * 2 > myEntries.size() ) {
+            resize(myEntries.size() * 2);
+            return (*this)[key];
+        }
+
+        ++mySize;
+        myEntries[i].key = key;
+        return myEntries[i].value;
+    }
+
+    // Copy of key, or null when it wasn't cloned
+    void* find(void const* key) const
+    {
+        for ( auto i = slot(key); myEntries[i].key; i = (i + 1) & myMask ) {
+            if ( myEntries[i].key == key )
+                return myEntries[i].value;
+        }
+
+        return nullptr;
+    }
+
+    std::size_t size() const
+    {
+        return mySize;
+    }
+
+private:
+    struct Entry
+    {
+        void const* key = nullptr;
+        void* value = nullptr;
+    };
+
+    std::size_t slot(void const* key) const
+    {
+        // Fibonacci hashing over the pointer less its alignment bits
+        auto const h = (reinterpret_cast<std::uintptr_t>(key) >> 3) * std::uint64_t(0x9E3779B97F4A7C15);
+        return static_cast<std::size_t>(h >> 32) & myMask;
+    }
+
+    void resize(std::size_t capacity)
+    {
+        std::vector<Entry> entries(capacity);
+        entries.swap(myEntries);
+        myMask = capacity - 1;
+        mySize = 0;
+        for ( auto const& e : entries ) {
+            if ( e.key )
+                (*this)[e.key] = e.value;
+        }
+    }
+
+private:
+    std::vector<Entry> myEntries;
+    std::size_t myMask = 0;
+    std::size_t mySize = 0;
+};
+
+using clone_map_t = CloneMap;
 
 template <typename T>
 std::unique_ptr<T> clone(std::unique_ptr<T> const& rhs)
@@ -138,9 +248,11 @@ void remap(std::vector<T>& rhs, clone_map_t const& map)
 template <typename T>
 void remap(T*& rhs, clone_map_t const& map)
 {
-    auto e = map.find(rhs);
-    if ( e != end(map) )
-        rhs = (T*)e->second;
+    if ( !rhs )
+        return;
+
+    if ( auto e = map.find(rhs) )
+        rhs = (T*)e;
 }
 
     } // namespace ast
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <iosfwd>
+
+#include <kyfoo/ast/Symbol.hpp>
+
+// Overload instrumentation is opt-in: define KYFOO_OVERLOAD_STATS for every
+// translation unit to count the candidates each call site weighs. Without it
+// the probe below expands to nothing.
+
+namespace kyfoo {
+    namespace lexer {
+        class Token;
+    }
+
+    namespace ast {
+
+class Module;
+
+bool overloadStatsEnabled();
+void resetOverloadStats();
+void printOverloadStats(std::ostream& stream);
+
+#ifdef KYFOO_OVERLOAD_STATS
+
+void recordOverloadLookup(Module const* module,
+                          lexer::Token const& site,
+                          CandidateCounts const& candidates);
+
+#define KYFOO_OVERLOAD_PROBE(module, site, hit) ::kyfoo::ast::recordOverloadLookup(module, site, (hit).candidates())
+
+#else
+
+#define KYFOO_OVERLOAD_PROBE(module, site, hit)
+
+#endif
+
+    } // namespace ast
+} // namespace kyfoo
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+namespace kyfoo {
+    namespace ast {
+
+class Declaration;
+class Module;
+
+// What a pass needs from a pass it depends on
+enum class PassDependency
+{
+    Node,   // the dependency has visited the same declaration
+    Module, // the dependency has visited the whole module
+};
+
+/**
+ * Runs passes over a module's top-level declarations and template instances
+ *
+ * Each walk visits the declarations, then the instances, and hands every
+ * node to each of its passes before moving on. Passes added in sequence
+ * share a walk. A new walk starts only when a pass depends on one in the
+ * current walk with PassDependency::Module.
+ */
+class PassManager
+{
+public:
+    using pass_t = std::function<void(Declaration const&)>;
+    using pass_id = std::size_t;
+
+    // Nodes a pass visits
+    enum Coverage
+    {
+        Declarations = 1 << 0,
+        Instances    = 1 << 1,
+        All          = Declarations | Instances,
+    };
+
+public:
+    PassManager();
+    ~PassManager();
+
+public:
+    pass_id add(pass_t pass, unsigned coverage = All);
+    void depend(pass_id pass, pass_id dependency, PassDependency kind);
+
+    // Walks needed to run the passes added so far
+    std::size_t walks() const;
+
+    void run(Module const& module) const;
+
+private:
+    std::vector<std::vector<pass_id>> plan() const;
+
+private:
+    struct Pass
+    {
+        pass_t run;
+        unsigned coverage;
+        std::vector<pass_id> moduleDependencies;
+    };
+
+    std::vector<Pass> myPasses;
+};
+
+    } // namespace ast
+} // namespace kyfoo
@@ -1,8 +1,11 @@
 #pragma once
 
+#include <array>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <tuple>
+#include <unordered_map>
 
 #include <kyfoo/Diagnostics.hpp>
 
@@ -34,7 +37,7 @@ public:
         : myDecl(decl)
     {
         if ( symSet )
-            mySymSets.push_back(symSet);
+            push(symSet);
     }
 
     explicit LookupHit(SymbolVariable const* symVar)
@@ -45,9 +48,13 @@ public:
     LookupHit(LookupHit const&) = delete;
 
     LookupHit(LookupHit&& rhs)
-        : mySymSets(std::move(rhs.mySymSets))
+        : myTrace(rhs.myTrace)
+        , myTraceSize(rhs.myTraceSize)
+        , mySpilledTrace(std::move(rhs.mySpilledTrace))
+        , myCandidates(rhs.myCandidates)
         , myDecl(rhs.myDecl)
     {
+        rhs.myTraceSize = 0;
         rhs.myDecl = nullptr;
     }
 
@@ -62,7 +69,10 @@ public:
     void swap(LookupHit& rhs)
     {
         using std::swap;
-        swap(mySymSets, rhs.mySymSets);
+        swap(myTrace, rhs.myTrace);
+        swap(myTraceSize, rhs.myTraceSize);
+        swap(mySpilledTrace, rhs.mySpilledTrace);
+        swap(myCandidates, rhs.myCandidates);
         swap(myDecl, rhs.myDecl);
     }
 
@@ -74,7 +84,7 @@ public:
     LookupHit& lookup(SymbolSet const* symSet, Declaration const* decl)
     {
         if ( symSet )
-            mySymSets.push_back(symSet);
+            push(symSet);
 
         if ( myDecl )
             throw std::runtime_error("declaration reference stomped");
@@ -94,16 +104,26 @@ public:
 
     LookupHit& append(LookupHit&& rhs)
     {
-        mySymSets.insert(end(mySymSets),
-                         begin(rhs.mySymSets), end(rhs.mySymSets));
+        for ( auto s : rhs.trace() )
+            push(s);
+
+        myCandidates += rhs.myCandidates;
         myDecl = rhs.myDecl;
 
-        rhs.mySymSets.clear();
+        rhs.myTraceSize = 0;
+        rhs.mySpilledTrace.clear();
+        rhs.myCandidates = CandidateCounts();
         rhs.myDecl = nullptr;
 
         return *this;
     }
 
+    LookupHit& addCandidates(CandidateCounts const& counts)
+    {
+        myCandidates += counts;
+        return *this;
+    }
+
     template <typename T>
     T const* as() const
     {
@@ -115,8 +135,9 @@ public:
 
     SymbolSet const* symSet() const
     {
-        if ( !mySymSets.empty() )
-            return mySymSets.front();
+        auto t = trace();
+        if ( !t.empty() )
+            return t[0];
 
         return nullptr;
     }
@@ -126,13 +147,41 @@ public:
         return myDecl;
     }
 
+    // Overload candidates weighed across the sets traced
+    CandidateCounts const& candidates() const
+    {
+        return myCandidates;
+    }
+
     Slice<SymbolSet const*> trace() const
     {
-        return mySymSets;
+        if ( !mySpilledTrace.empty() )
+            return mySpilledTrace;
+
+        return Slice<SymbolSet const*>(myTrace.data(), myTraceSize);
+    }
+
+private:
+    // Traces rarely pass more than a few sets, so they are kept inline
+    // until they outgrow myTrace
+    void push(SymbolSet const* symSet)
+    {
+        if ( mySpilledTrace.empty() && myTraceSize != myTrace.size() ) {
+            myTrace[myTraceSize++] = symSet;
+            return;
+        }
+
+        if ( mySpilledTrace.empty() )
+            mySpilledTrace.assign(begin(myTrace), end(myTrace));
+
+        mySpilledTrace.push_back(symSet);
     }
 
 private:
-    std::vector<SymbolSet const*> mySymSets;
+    std::array<SymbolSet const*, 4> myTrace{};
+    std::size_t myTraceSize = 0;
+    std::vector<SymbolSet const*> mySpilledTrace;
+    CandidateCounts myCandidates;
     Declaration const* myDecl = nullptr;
 };
 
@@ -170,18 +219,36 @@ public:
 public:
     void setDeclaration(Declaration* declaration);
     void append(std::unique_ptr<Declaration> declaration);
-    void import(Module& module);
+    void replaceDeclarations(std::size_t first, std::size_t last, std::size_t tail);
+    void merge(DeclarationScope& fragment);
 
     LookupHit findEquivalent(SymbolReference const& symbol) const;
     LookupHit findValue(Diagnostics& dgn, SymbolReference const& symbol) const;
     LookupHit findProcedureOverload(Diagnostics& dgn, SymbolReference const& procOverload) const;
 
-    SymbolSet* createSymbolSet(std::string const& name);
-    SymbolSet* createProcedureOverloadSet(std::string const& name);
+    // As above, against a set of this scope found beforehand
+    LookupHit findEquivalent(SymbolSet const* symSet, SymbolReference const& symbol) const;
+    LookupHit findValue(Diagnostics& dgn, SymbolSet const* symSet, SymbolReference const& symbol) const;
+    LookupHit findProcedureOverload(Diagnostics& dgn, SymbolSet const* procSet, SymbolReference const& procOverload) const;
+
+    struct VisibleSet
+    {
+        DeclarationScope const* scope;
+        SymbolSet const* set;
+    };
+    using visible_sets_t = std::shared_ptr<std::vector<VisibleSet> const>;
+
+    // Sets named id in this scope, its parents and the module's imports, in
+    // lookup order. Cached until the module or an import gains a set.
+    visible_sets_t visibleSymbols(lexer::intern_id_t id) const;
+    visible_sets_t visibleProcedures(lexer::intern_id_t id) const;
+
+    SymbolSet* createSymbolSet(std::string_view name, lexer::intern_id_t id);
+    SymbolSet* createProcedureOverloadSet(std::string_view name, lexer::intern_id_t id);
     bool addSymbol(Diagnostics& dgn, Symbol const& sym, Declaration& decl);
     bool addProcedure(Diagnostics& dgn, Symbol const& sym, ProcedureDeclaration& procDecl);
-    SymbolSet const* findSymbol(std::string const& identifier) const;
-    SymbolSet const* findProcedure(std::string const& identifier) const;
+    SymbolSet const* findSymbol(lexer::intern_id_t id) const;
+    SymbolSet const* findProcedure(lexer::intern_id_t id) const;
 
     Module* module();
     Declaration* declaration();
@@ -195,9 +262,30 @@ protected:
     DeclarationScope* myParent = nullptr;
     std::vector<std::unique_ptr<Declaration>> myDeclarations;
 
-    std::vector<SymbolSet> mySymbols;
-    std::vector<SymbolSet> myProcedureOverloads;
+    // Node-based, so SymbolSet pointers survive later inserts
+    std::unordered_map<lexer::intern_id_t, SymbolSet> mySymbols;
+    std::unordered_map<lexer::intern_id_t, SymbolSet> myProcedureOverloads;
     std::map<std::string, ImportDeclaration*> myImports;
+
+private:
+    struct VisibleSets
+    {
+        std::size_t generation;
+        visible_sets_t sets;
+    };
+    using visible_cache_t = std::unordered_map<lexer::intern_id_t, VisibleSets>;
+
+    visible_sets_t visible(visible_cache_t& cache,
+                           SymbolSet const* (DeclarationScope::*find)(lexer::intern_id_t) const,
+                           lexer::intern_id_t id) const;
+    std::size_t lookupGeneration() const;
+    void clearLookups();
+
+    // Guards appends and the caches; template instances from several
+    // modules may land in one scope
+    mutable std::mutex myMutex;
+    mutable visible_cache_t myVisibleSymbols;
+    mutable visible_cache_t myVisibleProcedures;
 };
 
 class DataSumScope : public DeclarationScope
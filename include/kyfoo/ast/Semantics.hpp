@@ -2,7 +2,11 @@
 
 #include <vector>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
+#include <type_traits>
+#include <unordered_map>
 
 #include <kyfoo/Slice.hpp>
 #include <kyfoo/ast/Expressions.hpp>
@@ -40,9 +44,11 @@ public:
     template<>
     typename operator_t::result_t operator()(Expression const& expr)
     {
-#define X(a,b) if ( auto e = expr.as<b>() ) return myOperator.expr##a(*e);
+        switch (expr.kind()) {
+#define X(a,b) case Expression::Kind::a: return myOperator.expr##a(static_cast<b const&>(expr));
         EXPRESSION_KINDS(X)
 #undef X
+        }
 
         throw std::runtime_error("invalid expression kind");
     }
@@ -50,9 +56,11 @@ public:
     template<>
     typename operator_t::result_t operator()(Expression& expr)
     {
-#define X(a,b) if ( auto e = expr.as<b>() ) return myOperator.expr##a(*e);
+        switch (expr.kind()) {
+#define X(a,b) case Expression::Kind::a: return myOperator.expr##a(static_cast<b&>(expr));
         EXPRESSION_KINDS(X)
 #undef X
+        }
 
         throw std::runtime_error("invalid expression kind");
     }
@@ -60,9 +68,11 @@ public:
     template <>
     typename operator_t::result_t operator()(Declaration& decl)
     {
-#define X(a,b,c) if ( auto d = decl.as<c>() ) return myOperator.decl##a(*d);
+        switch (decl.kind()) {
+#define X(a,b,c) case DeclKind::a: return myOperator.decl##a(static_cast<c&>(decl));
         DECLARATION_KINDS(X)
 #undef X
+        }
 
         throw std::runtime_error("invalid declaration kind");
     }
@@ -70,13 +80,210 @@ public:
     template <>
     typename operator_t::result_t operator()(Declaration const& decl)
     {
-#define X(a,b,c) if ( auto d = decl.as<c>() ) return myOperator.decl##a(*d);
+        switch (decl.kind()) {
+#define X(a,b,c) case DeclKind::a: return myOperator.decl##a(static_cast<c const&>(decl));
+        DECLARATION_KINDS(X)
+#undef X
+        }
+
+        throw std::runtime_error("invalid declaration kind");
+    }
+
+private:
+    operator_t myOperator;
+};
+
+/**
+ * Default hooks for DeepApply operators
+ *
+ * exprX/declX run before a node's children and return whether to visit
+ * them; postExprX/postDeclX run after. Operators derive from this and hide
+ * the hooks they need, taking nodes by reference or const reference.
+ */
+template <typename Dispatcher>
+struct DeepVisitor
+{
+    using result_t = void;
+    Dispatcher& dispatch;
+
+    DeepVisitor(Dispatcher& dispatch)
+        : dispatch(dispatch)
+    {
+    }
+
+#define X(a,b) \
+    template <typename T> bool expr##a(T&) { return true; } \
+    template <typename T> void postExpr##a(T&) {}
+    EXPRESSION_KINDS(X)
+#undef X
+
+#define X(a,b,c) \
+    template <typename T> bool decl##a(T&) { return true; } \
+    template <typename T> void postDecl##a(T&) {}
+    DECLARATION_KINDS(X)
+#undef X
+};
+
+/**
+ * Visits a node and everything beneath it
+ *
+ * Like ShallowApply, dispatch is a single switch on kind(). Expressions are
+ * followed into their sub-expressions and constraints; declarations into
+ * their symbol parameters, types, fields and definitions.
+ */
+template <template<class> typename Op>
+class DeepApply
+{
+public:
+    using operator_t = Op<DeepApply>;
+
+    DeepApply()
+        : myOperator(*this)
+    {
+    }
+
+    template <typename... Args>
+    DeepApply(Args&&... args)
+        : myOperator(*this, std::forward<Args>(args)...)
+    {
+    }
+
+    void operator()(Expression& expr) { visit(expr); }
+    void operator()(Expression const& expr) { visit(expr); }
+    void operator()(Declaration& decl) { visit(decl); }
+    void operator()(Declaration const& decl) { visit(decl); }
+
+    operator_t& op() { return myOperator; }
+    operator_t const& op() const { return myOperator; }
+
+private:
+    // T, const if U is
+    template <typename T, typename U>
+    using like_t = std::conditional_t<std::is_const<U>::value, T const, T>;
+
+    template <typename E>
+    void visit(E& expr)
+    {
+        switch (expr.kind()) {
+#define X(a,b) \
+        case Expression::Kind::a: \
+        { \
+            auto& e = static_cast<like_t<b, E>&>(expr); \
+            if ( myOperator.expr##a(e) ) \
+                children(e); \
+            myOperator.postExpr##a(e); \
+            return; \
+        }
+        EXPRESSION_KINDS(X)
+#undef X
+        }
+
+        throw std::runtime_error("invalid expression kind");
+    }
+
+    template <typename D>
+    void visitDecl(D& decl)
+    {
+        switch (decl.kind()) {
+#define X(a,b,c) \
+        case DeclKind::a: \
+        { \
+            auto& d = static_cast<like_t<c, D>&>(decl); \
+            if ( myOperator.decl##a(d) ) { \
+                visitSymbol(d); \
+                children(d); \
+            } \
+            myOperator.postDecl##a(d); \
+            return; \
+        }
         DECLARATION_KINDS(X)
 #undef X
+        }
 
         throw std::runtime_error("invalid declaration kind");
     }
 
+    void visit(Declaration& decl) { visitDecl(decl); }
+    void visit(Declaration const& decl) { visitDecl(decl); }
+
+    template <typename E>
+    void constraints(E& expr)
+    {
+        for ( auto const& c : expr.constraints() )
+            visit(static_cast<like_t<Expression, E>&>(*c));
+    }
+
+    template <typename E>
+    void subExpressions(E& expr)
+    {
+        for ( auto const& e : expr.expressions() )
+            visit(static_cast<like_t<Expression, E>&>(*e));
+
+        constraints(expr);
+    }
+
+    void children(PrimaryExpression& p) { constraints(p); }
+    void children(PrimaryExpression const& p) { constraints(p); }
+    void children(TupleExpression& t) { subExpressions(t); }
+    void children(TupleExpression const& t) { subExpressions(t); }
+    void children(ApplyExpression& a) { subExpressions(a); }
+    void children(ApplyExpression const& a) { subExpressions(a); }
+    void children(SymbolExpression& s) { subExpressions(s); }
+    void children(SymbolExpression const& s) { subExpressions(s); }
+
+    template <typename D>
+    void visitSymbol(D& decl)
+    {
+        for ( auto const& p : decl.symbol().parameters() )
+            visit(static_cast<like_t<Expression, D>&>(*p));
+    }
+
+    template <typename S>
+    void scope(S* defn)
+    {
+        if ( defn )
+            for ( auto const& d : defn->childDeclarations() )
+                visit(static_cast<like_t<Declaration, S>&>(*d));
+    }
+
+    template <typename D>
+    void children(D& decl)
+    {
+        using decl_t = std::remove_const_t<D>;
+        if constexpr ( std::is_same<decl_t, DataSumDeclaration>::value
+                    || std::is_same<decl_t, DataProductDeclaration>::value ) {
+            scope(decl.definition());
+        }
+        else if constexpr ( std::is_same<decl_t, DataSumDeclaration::Constructor>::value ) {
+            for ( auto const& f : decl.fields() )
+                visit(static_cast<like_t<Declaration, D>&>(*f));
+        }
+        else if constexpr ( std::is_same<decl_t, SymbolDeclaration>::value ) {
+            if ( auto e = decl.expression() )
+                visit(*e);
+        }
+        else if constexpr ( std::is_same<decl_t, ProcedureDeclaration>::value ) {
+            for ( auto const& p : decl.parameters() )
+                visit(static_cast<like_t<Declaration, D>&>(*p));
+
+            if ( auto r = decl.returnType() )
+                visit(*r);
+
+            if ( auto defn = decl.definition() ) {
+                scope(defn);
+                for ( auto const& e : defn->expressions() )
+                    visit(static_cast<like_t<Expression, D>&>(*e));
+            }
+        }
+        else if constexpr ( std::is_same<decl_t, VariableDeclaration>::value ) {
+            if ( auto c = decl.constraint() )
+                visit(*c);
+
+            if ( auto i = decl.initialization() )
+                visit(*i);
+        }
+    }
+
 private:
     operator_t myOperator;
 };
@@ -84,26 +291,29 @@ private:
 struct SymbolDependencyTracker
 {
     struct SymGroup {
-        std::string name;
+        lexer::intern_id_t id;
         std::size_t arity;
         int pass = 0;
         std::vector<Declaration*> declarations;
-        std::vector<SymGroup*> dependents;
+        std::vector<SymGroup*> dependencies;
+
+        // Position of the first declaration in the scope, if declared
+        std::size_t order = std::size_t(-1);
 
-        SymGroup(std::string const& name, std::size_t arity)
-            : name(name)
+        SymGroup(lexer::intern_id_t id, std::size_t arity)
+            : id(id)
             , arity(arity)
         {
         }
 
         bool operator < (SymGroup const& rhs) const
         {
-            return std::tie(name, arity) < std::tie(rhs.name, rhs.arity);
+            return std::tie(id, arity) < std::tie(rhs.id, rhs.arity);
         }
 
         bool operator == (SymGroup const& rhs) const
         {
-            return std::tie(name, arity) == std::tie(rhs.name, rhs.arity);
+            return std::tie(id, arity) == std::tie(rhs.id, rhs.arity);
         }
 
         void add(Declaration& decl)
@@ -111,34 +321,34 @@ struct SymbolDependencyTracker
             declarations.push_back(&decl);
         }
 
-        void addDependent(SymGroup& group)
+        void addDependency(SymGroup& group)
         {
-            dependents.push_back(&group);
+            dependencies.push_back(&group);
         }
+    };
 
-        void defer(int deferPass)
-        {
-            if ( pass >= deferPass )
-                return;
-
-            pass = deferPass;
-            for ( auto& d : dependents )
-                d->defer(pass + 1);
-        }
+    // A reference from decl to the declarations in a group
+    struct Reference {
+        Declaration* decl;
+        SymGroup* from;
+        SymGroup* to;
     };
 
     Module* mod;
     Diagnostics& dgn;
     std::vector<std::unique_ptr<SymGroup>> groups;
+    std::unordered_map<std::uint64_t, SymGroup*> index;
+    std::vector<Reference> references;
+    std::size_t declared = 0;
 
     SymbolDependencyTracker(Module* mod, Diagnostics& dgn);
 
-    SymGroup* create(std::string const& name, std::size_t arity);
-    SymGroup* findOrCreate(std::string const& name, std::size_t arity);
+    SymGroup* create(lexer::intern_id_t id, std::size_t arity);
+    SymGroup* findOrCreate(lexer::intern_id_t id, std::size_t arity);
 
     void add(Declaration& decl);
     void addDependency(Declaration& decl,
-                       std::string const& name,
+                       lexer::intern_id_t id,
                        std::size_t arity);
 
     void sortPasses();
@@ -167,6 +377,32 @@ Expression const* resolveIndirections(Expression const* expr);
 // todo: functor like ValueMatcher
 bool matchEquivalent(Expression const& lhs, Expression const& rhs);
 bool matchEquivalent(Slice<Expression*> lhs, Slice<Expression*> rhs);
+bool hashEquivalent(Expression const& expr, std::size_t& hash);
+bool hashEquivalent(binding_set_t const& bindings, std::size_t& hash);
+
+/**
+ * Uniques resolved concrete type expressions
+ *
+ * Equivalent expressions, looking through symbol aliases, map to a single
+ * canonical node owned by the table, so identity of concrete types is a
+ * pointer compare. Expressions that mention symbol variables or are not
+ * fully resolved have no canonical node. Only constraints and symbol
+ * parameters are entered; value expressions stay out of the table.
+ */
+class TypeTable
+{
+public:
+    TypeTable();
+    ~TypeTable();
+
+public:
+    Expression const* canonical(Expression const& expr);
+    std::size_t size() const;
+
+private:
+    mutable std::mutex myMutex;
+    std::unordered_multimap<std::size_t, std::unique_ptr<Expression>> myTypes;
+};
 
 std::vector<PrimaryExpression*> gatherFreeVariables(Expression& expr);
 bool hasFreeVariable(Expression const& expr);
@@ -2,7 +2,10 @@
 
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include <kyfoo/Slice.hpp>
@@ -25,13 +28,28 @@ class SymbolVariable;
 
 using binding_set_t = std::map<SymbolVariable const*, Expression const*>;
 
+// Prototypes an overload lookup had to choose from
+struct CandidateCounts
+{
+    std::size_t prototypes = 0; // with the name
+    std::size_t considered = 0; // left after pruning, up to the match
+    std::size_t matched = 0;
+
+    CandidateCounts& operator += (CandidateCounts const& rhs)
+    {
+        prototypes += rhs.prototypes;
+        considered += rhs.considered;
+        matched += rhs.matched;
+        return *this;
+    }
+};
+
 class Symbol : public IIO
 {
 public:
     using paramlist_t = std::vector<std::unique_ptr<Expression>>;
 
 public:
-    explicit Symbol(std::string const& name);
     Symbol(lexer::Token const& identifier,
            std::vector<std::unique_ptr<Expression>>&& parameters);
     explicit Symbol(lexer::Token const& identifier);
@@ -63,13 +81,14 @@ public:
 public:
     void resolveSymbols(Diagnostics& dgn, IResolver& resolver);
     void bindVariables(Diagnostics& dgn, IResolver& resolver, binding_set_t const& bindings);
-    SymbolVariable* findVariable(std::string const& identifier);
-    SymbolVariable const* findVariable(std::string const& identifier) const;
-    SymbolVariable* createVariable(std::string const& identifier);
+    SymbolVariable* findVariable(lexer::intern_id_t id);
+    SymbolVariable const* findVariable(lexer::intern_id_t id) const;
+    SymbolVariable* createVariable(lexer::Token const& identifier);
 
 public:
     lexer::Token const& identifier() const;
-    std::string const& name() const;
+    std::string_view name() const;
+    lexer::intern_id_t id() const;
     paramlist_t const& parameters() const;
     bool isConcrete() const;
     bool hasFreeVariables() const;
@@ -87,16 +106,18 @@ public:
 
 public:
     /*implicit*/ SymbolReference(Symbol const& symbol);
-    /*implicit*/ SymbolReference(std::string const& name);
-    SymbolReference(std::string const& name, paramlist_t parameters);
+    explicit SymbolReference(lexer::Token const& identifier);
+    SymbolReference(lexer::Token const& identifier, paramlist_t parameters);
     ~SymbolReference();
 
 public:
-    std::string const& name() const;
+    lexer::Token const& identifier() const;
+    std::string_view name() const;
+    lexer::intern_id_t id() const;
     paramlist_t const& parameters() const;
 
 private:
-    std::string const* myName;
+    lexer::Token myIdentifier;
     paramlist_t myParameters;
 };
 
@@ -110,11 +131,14 @@ public:
         std::vector<Expression*> paramlist;
         Declaration* declaration;
         std::vector<binding_set_t> instanceBindings;
-        std::vector<Declaration*> instantiations;
+        std::vector<Declaration*> instantiations; // null where resolution threw
+        std::unordered_multimap<std::size_t, std::size_t> instanceIndex; // binding hash -> instantiation
+        std::vector<std::size_t> unhashedInstances; // bindings with no canonical hash
+        std::size_t cloneSize = 0; // nodes cloned by the last instantiation
     };
 
 public:
-    SymbolSet(DeclarationScope* scope, std::string const& name);
+    SymbolSet(DeclarationScope* scope, std::string_view name, lexer::intern_id_t id);
 
     SymbolSet(SymbolSet const& rhs);
     SymbolSet& operator = (SymbolSet const& rhs);
@@ -127,11 +151,12 @@ public:
     void swap(SymbolSet& rhs);
 
 public:
-    bool operator < (std::string const& rhs) const { return myName < rhs; }
-    bool operator == (std::string const& rhs) const { return myName == rhs; }
+    bool operator < (lexer::intern_id_t rhs) const { return myId < rhs; }
+    bool operator == (lexer::intern_id_t rhs) const { return myId == rhs; }
 
 public:
-    std::string const& name() const;
+    std::string_view name() const;
+    lexer::intern_id_t id() const;
     Slice<SymbolTemplate> const prototypes() const;
 
     void append(paramlist_t const& paramlist, Declaration& declaration);
@@ -142,6 +167,7 @@ public:
     struct TemplateInstance {
         Declaration const* parent;
         Declaration const* instance;
+        CandidateCounts candidates;
     };
 
     TemplateInstance findValue(Diagnostics& dgn,
@@ -154,10 +180,27 @@ private:
                                  SymbolTemplate& proto,
                                  binding_set_t const& bindingSet);
 
+    // Prototypes whose parameter at one position matches only values of a
+    // given declaration, and those where it may match anything
+    struct ParameterIndex {
+        std::unordered_map<Declaration const*, std::vector<std::size_t>> concrete;
+        std::vector<std::size_t> open;
+    };
+
+    struct ArityIndex {
+        std::vector<std::size_t> prototypes;
+        std::vector<ParameterIndex> parameters;
+    };
+
 private:
     DeclarationScope* myScope = nullptr;
-    std::string myName;
+    std::string_view myName;
+    lexer::intern_id_t myId = lexer::invalid_intern_id;
     std::vector<SymbolTemplate> mySet;
+    std::unordered_map<std::size_t, ArityIndex> myIndex;
+
+    // Guards the prototypes and their index; never held while resolving
+    std::mutex myMutex;
 };
 
     } // namesapce ast
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+
+namespace kyfoo {
+    namespace lexer {
+
+inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+inline bool isLineBreak(char c)
+{
+    return c == '\r' || c == '\n';
+}
+
+inline bool isLetter(char c)
+{
+    return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z');
+}
+
+inline bool isNumber(char c)
+{
+    return '0' <= c && c <= '9';
+}
+
+inline bool isIdentifierMid(char c)
+{
+    return isLetter(c) || isNumber(c) || c == '_' || c == '-';
+}
+
+// Instruction sets the character scanners can run on, in order of preference
+enum class CharScanIsa
+{
+    Scalar,
+    SSE2,
+    AVX2,
+};
+
+const char* to_string(CharScanIsa isa);
+
+// Best instruction set supported by this processor
+CharScanIsa detectCharScanIsa();
+
+// Instruction set the scanners currently dispatch to; defaults to the
+// detected one. Requests above what the processor supports are clamped.
+CharScanIsa charScanIsa();
+void setCharScanIsa(CharScanIsa isa);
+
+// Each returns the first position in [first, last) that is not in the
+// respective character class, or last
+char const* skipIdentifierMid(char const* first, char const* last);
+char const* skipSpaces(char const* first, char const* last);
+char const* findLineBreak(char const* first, char const* last);
+
+// Number of '\n' in [first, last)
+std::size_t countNewlines(char const* first, char const* last);
+
+    } // namespace lexer
+} // namespace kyfoo
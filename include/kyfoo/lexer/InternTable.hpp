@@ -0,0 +1,44 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Token.hpp"
+
+namespace kyfoo {
+    namespace lexer {
+
+// Maps identifier text to dense integer ids.
+// Id 0 is reserved for the empty identifier. Safe to use from several
+// scanners at once.
+class InternTable
+{
+public:
+    InternTable();
+    ~InternTable();
+
+public:
+    InternTable(InternTable const&) = delete;
+    void operator = (InternTable const&) = delete;
+
+public:
+    intern_id_t intern(std::string_view text);
+    intern_id_t find(std::string_view text) const;
+
+    std::string_view text(intern_id_t id) const;
+    std::size_t size() const;
+
+private:
+    mutable std::shared_mutex myMutex;
+    std::deque<std::string> myStrings;
+    std::vector<std::string_view> myTexts;
+    std::unordered_map<std::string_view, intern_id_t> myIds;
+};
+
+    } // namespace lexer
+} // namespace kyfoo
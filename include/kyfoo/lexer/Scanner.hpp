@@ -1,8 +1,14 @@
 #pragma once
 
 #include <deque>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include <kyfoo/Arena.hpp>
+
+#include "InternTable.hpp"
+#include "SourceBuffer.hpp"
 #include "Token.hpp"
 
 namespace kyfoo {
@@ -10,10 +16,32 @@ namespace kyfoo {
 
 using indent_width_t = std::size_t;
 
+enum class ScanMode
+{
+    Stream,     // lex on demand, buffering only what backtracking needs
+    Tokenized,  // lex the whole source up front into one token array
+};
+
+// A remembered match of some production at a token position. A null
+// capture means the production did not match there.
+struct ScanMemo
+{
+    std::size_t length = 0;
+    void const* capture = nullptr;
+};
+
 class Scanner
 {
 public:
-    explicit Scanner(std::istream&);
+    Scanner(SourceBuffer const& source, InternTable& interns, ScanMode mode = ScanMode::Stream);
+
+    // Scans only [first, last) of source, where first starts a line at
+    // indent zero so no indentation state carries over from before it
+    Scanner(SourceBuffer const& source,
+            InternTable& interns,
+            ScanMode mode,
+            source_offset_t first,
+            source_offset_t last);
 
 public:
     Scanner(Scanner const&) = delete;
@@ -24,39 +52,89 @@ public:
     Token next();
     Token peek(std::size_t = 0);
 
-    void beginScan();
+    std::size_t beginScan();
     void endScan();
-    void rollbackScan();
+    void rollbackScan(std::size_t savePoint);
 
     bool eof() const;
     bool hasError() const;
 
     explicit operator bool() const;
 
+    ScanMode mode() const;
+
+    // Index of the next token counted from the start of the scanned range
+    std::size_t position() const;
+    void skip(std::size_t count);
+
+    // Packrat memo keyed by (production, position), off by default. Entries
+    // are dropped once an outermost scan commits, since nothing can roll
+    // back behind that point.
+    void memoize(bool enable);
+    ScanMemo const* recall(void const* production) const;
+    void remember(void const* production, std::size_t position, ScanMemo memo);
+
+    // Per-parse arena for grammar captures. It is cleared when an outermost
+    // scan begins with nothing memoized, by which point the previous match
+    // has been turned into AST nodes.
+    Arena& captures();
+
+    // Drops captures made since mark by a failed match, unless the memo
+    // may still refer to them
+    void release(Arena::Mark const& mark);
+
+    // Every token of the scanned range, ending with EndOfFile; tokenized mode only
+    std::vector<Token> const& tokens() const;
+
 protected:
     Token readNext();
+    void tokenize();
+    void reach(std::size_t index);
 
     char nextChar();
-    char peekChar();
+    char peekChar() const;
+    void ungetChar();
+    bool atEnd() const;
 
-    Token indent(line_index_t line, column_index_t column, indent_width_t indent);
+    Token token(TokenKind kind, char const* first, char const* last, intern_id_t id = invalid_intern_id) const;
+    Token indent(indent_width_t indent);
     void bumpLine();
 
 private:
-    std::istream& myStream;
+    SourceBuffer const& mySource;
+    InternTable& myInterns;
+    char const* myCursor = nullptr;
+    char const* myEnd = nullptr;
+    char const* myLineStart = nullptr;
 
-    struct InternalScanState
-    {
-        std::size_t readIndex;
-    };
-    InternalScanState myState;
+    ScanMode myMode;
+    std::size_t myReadIndex = 0;
+    std::size_t myScanDepth = 0;
+    std::size_t myConsumed = 0;
 
-    std::vector<InternalScanState> mySavePoints;
     std::vector<indent_width_t> myIndents;
     std::deque<Token> myBuffer;
 
-    line_index_t myLine = 1;
-    column_index_t myColumn = 1;
+    // Tokenized mode. Errors and eof only become visible once the parser
+    // reaches the tokens whose lexing caused them, same as when streaming.
+    static constexpr std::size_t npos = std::size_t(-1);
+    std::vector<Token> myTokens;
+    std::size_t myReachIndex = 0;
+    std::size_t myEndIndex = npos;
+    std::size_t myErrorIndex = npos;
+
+    struct MemoKeyHash
+    {
+        std::size_t operator()(std::pair<void const*, std::size_t> const& key) const
+        {
+            return std::hash<void const*>()(key.first) ^ (key.second * 0x9e3779b97f4a7c15ull);
+        }
+    };
+
+    bool myMemoize = false;
+    std::unordered_map<std::pair<void const*, std::size_t>, ScanMemo, MemoKeyHash> myMemo;
+    Arena myCaptures;
+
     bool myError = false;
 };
 
@@ -65,8 +143,8 @@ class ScanPoint
 public:
     /*implicit*/ ScanPoint(Scanner& scanner)
         : myScanner(scanner)
+        , mySavePoint(scanner.beginScan())
     {
-        myScanner.beginScan();
         myOpen = true;
     }
 
@@ -83,7 +161,7 @@ public:
     ~ScanPoint()
     {
         if ( myOpen )
-            myScanner.rollbackScan();
+            myScanner.rollbackScan(mySavePoint);
     }
 
 public:
@@ -97,11 +175,16 @@ public:
 
     void restart()
     {
-        myScanner.rollbackScan();
-        myScanner.beginScan();
+        myScanner.rollbackScan(mySavePoint);
+        mySavePoint = myScanner.beginScan();
         myOpen = true;
     }
 
+    bool open() const
+    {
+        return myOpen;
+    }
+
 public:
     Token next()
     {
@@ -113,8 +196,39 @@ public:
         return myScanner.peek(lookAhead);
     }
 
+    std::size_t position() const
+    {
+        return myScanner.position();
+    }
+
+    void skip(std::size_t count)
+    {
+        myScanner.skip(count);
+    }
+
+    ScanMemo const* recall(void const* production) const
+    {
+        return myScanner.recall(production);
+    }
+
+    void remember(void const* production, std::size_t position, ScanMemo memo)
+    {
+        myScanner.remember(production, position, memo);
+    }
+
+    Arena& captures()
+    {
+        return myScanner.captures();
+    }
+
+    void release(Arena::Mark const& mark)
+    {
+        myScanner.release(mark);
+    }
+
 private:
     Scanner& myScanner;
+    std::size_t mySavePoint;
     bool myOpen = false;
 };
 
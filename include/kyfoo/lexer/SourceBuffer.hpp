@@ -0,0 +1,88 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Token.hpp"
+
+namespace kyfoo {
+    namespace lexer {
+
+// Contiguous view of an entire source text.
+// Each live buffer is registered under a small id so that tokens can refer
+// to their lexeme by offset. Tokens must not outlive the buffer they were
+// scanned from; they also carry the id's generation, so that lookups through
+// a reused id fail instead of answering from another buffer.
+class SourceBuffer
+{
+public:
+    // Takes ownership of text
+    explicit SourceBuffer(std::string&& text);
+
+    // Borrows text, which must outlive the buffer
+    explicit SourceBuffer(std::string_view text);
+
+    ~SourceBuffer();
+
+public:
+    SourceBuffer(SourceBuffer const&) = delete;
+    void operator = (SourceBuffer const&) = delete;
+
+public:
+    static std::unique_ptr<SourceBuffer> fromFile(std::experimental::filesystem::path const& path);
+    static std::unique_ptr<SourceBuffer> fromStream(std::istream& stream);
+
+    // Null unless the buffer registered under id has that generation
+    static SourceBuffer const* find(source_id_t id, source_generation_t generation);
+
+public:
+    source_id_t id() const;
+    source_generation_t generation() const;
+
+    char const* begin() const;
+    char const* end() const;
+    std::size_t size() const;
+
+    std::string_view text() const;
+
+    line_index_t line(source_offset_t offset) const;
+    column_index_t column(source_offset_t offset) const;
+
+public:
+    // A range of this buffer whose text appears unchanged in another
+    struct Relocation
+    {
+        source_offset_t first;
+        source_offset_t last;
+        source_offset_t target;
+    };
+
+    // Answers line and column queries within relocations from target.
+    // Keeps positions of tokens scanned from an earlier revision of a source
+    // accurate after it has been edited.
+    void forward(SourceBuffer const* target, std::vector<Relocation> relocations);
+
+private:
+    void registerSelf();
+    SourceBuffer const& resolve(source_offset_t& offset) const;
+    std::vector<source_offset_t> const& lineStarts() const;
+
+private:
+    std::string myStorage;
+    std::string_view myText;
+    source_id_t myId = invalid_source_id;
+    source_generation_t myGeneration = 0;
+
+    SourceBuffer const* myTarget = nullptr;
+    std::vector<Relocation> myRelocations;
+
+    mutable std::once_flag myLineStartsFlag;
+    mutable std::vector<source_offset_t> myLineStarts;
+};
+
+    } // namespace lexer
+} // namespace kyfoo
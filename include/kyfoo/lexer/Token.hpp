@@ -1,6 +1,8 @@
 #pragma once
 
-#include <string>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
 
 #include "TokenKind.hpp"
 
@@ -9,26 +11,34 @@ namespace kyfoo {
 
 using line_index_t = std::size_t;
 using column_index_t = std::size_t;
+using intern_id_t = std::uint32_t;
+using source_id_t = std::uint16_t;
+using source_generation_t = std::uint8_t;
+using source_offset_t = std::uint32_t;
 
+constexpr intern_id_t invalid_intern_id = 0;
+constexpr source_id_t invalid_source_id = 0;
+
+// Refers to a lexeme by its position in a registered SourceBuffer.
+// Line and column are looked up from the buffer on demand; looking them up
+// after the buffer is gone throws.
 class Token
 {
+    source_offset_t myOffset = 0;
+    source_offset_t myLength = 0;
+    intern_id_t myId = invalid_intern_id;
+    source_id_t mySource = invalid_source_id;
     TokenKind myKind = TokenKind::Undefined;
-    std::string myLexeme;
-    line_index_t myLine = 0;
-    column_index_t myColumn = 0;
+    source_generation_t myGeneration = 0;
 
 public:
-    explicit Token();
+    explicit Token() = default;
     Token(TokenKind kind,
-          line_index_t line,
-          column_index_t column,
-          std::string const& lexeme);
-
-public:
-    Token(Token const&);
-    Token(Token const&&);
-    Token& operator = (Token const&);
-    void swap(Token&);
+          source_id_t source,
+          source_generation_t generation,
+          source_offset_t offset,
+          source_offset_t length,
+          intern_id_t id = invalid_intern_id);
 
 public:
     bool operator < (Token const&) const;
@@ -39,8 +49,16 @@ public:
     TokenKind kind() const;
     line_index_t line() const;
     column_index_t column() const;
-    std::string const& lexeme() const;
+    std::string_view lexeme() const;
+    intern_id_t id() const;
+
+    source_id_t source() const;
+    source_offset_t offset() const;
+    source_offset_t length() const;
 };
 
+static_assert(sizeof(Token) == 16, "Token should stay compact");
+static_assert(std::is_trivially_copyable<Token>::value, "Token should be trivially copyable");
+
     } // namespace lexer
 } // namespace kyfoo
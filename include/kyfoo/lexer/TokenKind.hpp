@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+
 namespace kyfoo {
     namespace lexer {
 
@@ -51,7 +53,7 @@ namespace kyfoo {
     X(_keywordEnd, "keyword end")
 
 #define X(A,B) A,
-enum class TokenKind
+enum class TokenKind : std::uint8_t
 {
 TOKEN_DEFINITIONS(X)
 };
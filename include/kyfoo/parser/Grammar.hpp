@@ -1,11 +1,13 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <tuple>
 #include <utility>
 
 #include <kyfoo/lexer/Scanner.hpp>
 #include <kyfoo/lexer/TokenKind.hpp>
+#include <kyfoo/parser/GrammarStats.hpp>
 
 namespace kyfoo {
     namespace ast {
@@ -16,6 +18,76 @@ namespace kyfoo {
 // Keep out of kyfoo::parser namespace to reduce decorated name length
 namespace g {
 
+// FIRST set of a production and whether it can match nothing, computed at
+// compile time. Productions derived from a combinator take its overload of
+// lookahead, defined after the combinators.
+
+class TokenSet
+{
+public:
+    constexpr TokenSet() = default;
+
+    constexpr explicit TokenSet(kyfoo::lexer::TokenKind kind)
+        : myBits(std::uint64_t(1) << static_cast<unsigned>(kind))
+    {
+    }
+
+private:
+    constexpr explicit TokenSet(std::uint64_t bits)
+        : myBits(bits)
+    {
+    }
+
+public:
+    constexpr bool contains(kyfoo::lexer::TokenKind kind) const
+    {
+        return (myBits >> static_cast<unsigned>(kind)) & 1;
+    }
+
+    constexpr bool empty() const
+    {
+        return !myBits;
+    }
+
+    constexpr TokenSet operator | (TokenSet rhs) const
+    {
+        return TokenSet(myBits | rhs.myBits);
+    }
+
+    constexpr TokenSet operator & (TokenSet rhs) const
+    {
+        return TokenSet(myBits & rhs.myBits);
+    }
+
+    constexpr TokenSet operator - (TokenSet rhs) const
+    {
+        return TokenSet(myBits & ~rhs.myBits);
+    }
+
+private:
+    std::uint64_t myBits = 0;
+};
+
+static_assert(static_cast<unsigned>(kyfoo::lexer::TokenKind::_keywordEnd) < 64,
+              "TokenSet must be widened to cover every token kind");
+
+struct Lookahead
+{
+    TokenSet first;
+    bool nullable;
+};
+
+template <typename T>
+constexpr Lookahead lookahead();
+
+// Whether T could match at the scanner's next token
+template <typename T>
+bool viable(kyfoo::lexer::ScanPoint& scan)
+{
+    constexpr auto la = lookahead<T>();
+    return la.nullable || la.first.contains(scan.peek().kind());
+}
+
 template <kyfoo::lexer::TokenKind K>
 class Terminal
 {
@@ -25,6 +97,8 @@ public:
 public:
     bool match(kyfoo::lexer::ScanPoint scan, std::size_t& matches)
     {
+        KYFOO_GRAMMAR_PROBE(Terminal, scan);
+
         if ( scan.peek().kind() != K )
             return false;
 
@@ -82,6 +156,8 @@ public:
 public:
     bool match(kyfoo::lexer::ScanPoint scan, std::size_t& matches)
     {
+        KYFOO_GRAMMAR_PROBE(And, scan);
+
         if ( subMatch<0>(scan, matches) ) {
             return scan.commit();
         }
@@ -181,15 +257,20 @@ public:
 public:
     bool match(kyfoo::lexer::ScanPoint scan, std::size_t& matches)
     {
+        KYFOO_GRAMMAR_PROBE(Or, scan);
+
+        // Each alternative reuses the captures of the one that failed before it
+        auto const mark = scan.captures().mark();
+
         std::size_t m = 0;
-        if ( std::get<0>(myTerms).match(scan, m) ) {
+        if ( viable<term_t<0>>(scan) && std::get<0>(myTerms).match(scan, m) ) {
             matches += m;
             myCapture = 0;
             return scan.commit();
         }
 
         m = 0;
-        if ( subMatch<1>(scan, m) ) {
+        if ( subMatch<1>(scan, mark, m) ) {
             matches += m;
             return scan.commit();
         }
@@ -216,9 +297,17 @@ public:
 
 private:
     template <int N>
-    bool subMatch(kyfoo::lexer::ScanPoint& scan, std::size_t& matches)
+    bool subMatch(kyfoo::lexer::ScanPoint& scan,
+                  kyfoo::Arena::Mark const& mark,
+                  std::size_t& matches)
     {
+        // Alternatives that can't start here are not tried
+        if ( !viable<term_t<N>>(scan) )
+            return subMatch<N + 1>(scan, mark, matches);
+
+        KYFOO_GRAMMAR_RESTART(Or);
         scan.restart();
+        scan.release(mark);
 
         std::size_t m = 0;
         if ( std::get<N>(myTerms).match(scan, m) ) {
@@ -227,16 +316,21 @@ private:
             return true;
         }
 
-        return subMatch<N + 1>(scan, matches);
+        return subMatch<N + 1>(scan, mark, matches);
     }
 
     template <>
-    bool subMatch<sizeof...(T)>(kyfoo::lexer::ScanPoint&, std::size_t&)
+    bool subMatch<sizeof...(T)>(kyfoo::lexer::ScanPoint&,
+                                kyfoo::Arena::Mark const&,
+                                std::size_t&)
     {
         return false;
     }
 
 private:
+    template <std::size_t N>
+    using term_t = std::tuple_element_t<N, std::tuple<T...>>;
+
     std::tuple<T...> myTerms;
     std::size_t myCapture = 0;
 };
@@ -276,11 +370,13 @@ public:
 public:
     bool match(kyfoo::lexer::ScanPoint scan, std::size_t& matches)
     {
+        KYFOO_GRAMMAR_PROBE(Long, scan);
+
         std::size_t longest = 0;
         std::size_t length = 0;
 
         std::size_t m = 0;
-        if ( std::get<0>(myTerms).match(scan, m) ) {
+        if ( viable<term_t<0>>(scan) && std::get<0>(myTerms).match(scan, m) ) {
             length = m;
         }
 
@@ -289,12 +385,12 @@ public:
         if ( !length )
             return false;
 
-        // Rescan to commit the longest term
+        // Every term keeps its own capture, so committing the longest only
+        // has to move past the tokens it already matched
+        KYFOO_GRAMMAR_RESTART(Long);
         scan.restart();
-
-        m = 0;
-        match_nth(longest, scan, m);
-        matches += m;
+        scan.skip(length);
+        matches += length;
         myCapture = longest;
         return scan.commit();
     }
@@ -316,6 +412,10 @@ private:
                   std::size_t& longest,
                   std::size_t& length)
     {
+        if ( !viable<term_t<N>>(scan) )
+            return subMatch<N + 1>(scan, longest, length);
+
+        KYFOO_GRAMMAR_RESTART(Long);
         scan.restart();
 
         std::size_t m = 0;
@@ -335,33 +435,10 @@ private:
         // nop
     }
 
-    bool match_nth(std::size_t index,
-                   kyfoo::lexer::ScanPoint& scan,
-                   std::size_t& matches)
-    {
-        return match_nth_impl<0>(index, scan, matches);
-    }
-
+private:
     template <std::size_t N>
-    bool match_nth_impl(std::size_t index,
-                        kyfoo::lexer::ScanPoint& scan,
-                        std::size_t& matches)
-    {
-        if ( N == index )
-            return std::get<N>(myTerms).match(scan, matches);
+    using term_t = std::tuple_element_t<N, std::tuple<T...>>;
 
-        return match_nth_impl<N + 1>(index, scan, matches);
-    }
-
-    template <>
-    bool match_nth_impl<sizeof...(T)>(std::size_t,
-                                      kyfoo::lexer::ScanPoint&,
-                                      std::size_t&)
-    {
-        return false;
-    }
-
-private:
     std::tuple<T...> myTerms;
     std::size_t myCapture = 0;
 };
@@ -380,6 +457,8 @@ public:
 public:
     bool match(kyfoo::lexer::ScanPoint scan, std::size_t& matches)
     {
+        KYFOO_GRAMMAR_PROBE(Opt, scan);
+
         if ( myRhs.match(scan, matches) ) {
             myCapture = true;
             return scan.commit();
@@ -387,7 +466,7 @@ public:
 
         myCapture = false;
 
-        return true;
+        return scan.commit();
     }
 
     T const* capture() const
@@ -417,6 +496,8 @@ public:
 public:
     bool match(kyfoo::lexer::ScanPoint scan, std::size_t& matches)
     {
+        KYFOO_GRAMMAR_PROBE(Repeat, scan);
+
         myCaptures.clear();
 
         std::size_t m = 0;
@@ -454,6 +535,8 @@ public:
 public:
     bool match(kyfoo::lexer::ScanPoint scan, std::size_t& matches)
     {
+        KYFOO_GRAMMAR_PROBE(Repeat2, scan);
+
         myCaptures.clear();
         myWeaveCaptures.clear();
 
@@ -511,6 +594,8 @@ public:
 public:
     bool match(kyfoo::lexer::ScanPoint scan, std::size_t& matches)
     {
+        KYFOO_GRAMMAR_PROBE(OneOrMore, scan);
+
         myCaptures.clear();
 
         std::size_t m = 0;
@@ -551,6 +636,8 @@ public:
 public:
     bool match(kyfoo::lexer::ScanPoint scan, std::size_t& matches)
     {
+        KYFOO_GRAMMAR_PROBE(OneOrMore2, scan);
+
         myCaptures.clear();
         myWeaveCaptures.clear();
 
@@ -695,6 +782,107 @@ constexpr OneOrMore2<U, V> operator + (U const& lhs, V const& rhs)
     return OneOrMore2<U, V>(lhs, rhs);
 }
 
+// Lookahead
+
+constexpr Lookahead optional(Lookahead rhs)
+{
+    return { rhs.first, true };
+}
+
+template <typename T>
+constexpr Lookahead lookahead()
+{
+    return lookahead(static_cast<T const*>(nullptr));
+}
+
+// A sequence only looks past a factor that can match nothing
+template <typename T>
+constexpr Lookahead sequence()
+{
+    return lookahead<T>();
+}
+
+template <typename T, typename U, typename... V>
+constexpr Lookahead sequence()
+{
+    return lookahead<T>().nullable
+        ? Lookahead{ lookahead<T>().first | sequence<U, V...>().first, sequence<U, V...>().nullable }
+        : lookahead<T>();
+}
+
+template <typename T>
+constexpr Lookahead choice()
+{
+    return lookahead<T>();
+}
+
+template <typename T, typename U, typename... V>
+constexpr Lookahead choice()
+{
+    return { lookahead<T>().first | choice<U, V...>().first,
+             lookahead<T>().nullable || choice<U, V...>().nullable };
+}
+
+template <kyfoo::lexer::TokenKind K>
+constexpr Lookahead lookahead(Terminal<K> const*)
+{
+    return { TokenSet(K), false };
+}
+
+template <typename... T>
+constexpr Lookahead lookahead(And<T...> const*)
+{
+    return sequence<T...>();
+}
+
+template <typename... T>
+constexpr Lookahead lookahead(Or<T...> const*)
+{
+    return choice<T...>();
+}
+
+template <typename... T>
+constexpr Lookahead lookahead(Long<T...> const*)
+{
+    return choice<T...>();
+}
+
+template <typename T>
+constexpr Lookahead lookahead(Opt<T> const*)
+{
+    return optional(lookahead<T>());
+}
+
+template <typename T>
+constexpr Lookahead lookahead(Repeat<T> const*)
+{
+    return optional(lookahead<T>());
+}
+
+template <typename U, typename V>
+constexpr Lookahead lookahead(Repeat2<U, V> const*)
+{
+    return optional(lookahead<U>());
+}
+
+template <typename T>
+constexpr Lookahead lookahead(OneOrMore<T> const*)
+{
+    return lookahead<T>();
+}
+
+template <typename U, typename V>
+constexpr Lookahead lookahead(OneOrMore2<U, V> const*)
+{
+    return lookahead<U>();
+}
+
+template <typename T>
+constexpr TokenSet first()
+{
+    return lookahead<T>().first;
+}
+
 } // namespace g
 
 namespace kyfoo {
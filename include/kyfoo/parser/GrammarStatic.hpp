@@ -1,267 +1,610 @@
 #pragma once
 
+#include <cstddef>
+#include <tuple>
+#include <utility>
+#include <vector>
+
 #include <kyfoo/lexer/Scanner.hpp>
 #include <kyfoo/lexer/Token.hpp>
 #include <kyfoo/lexer/TokenKind.hpp>
+#include <kyfoo/parser/Grammar.hpp>
 
+// Stateless counterpart of g. Combinators are never instantiated: match only
+// records the tokens and choices it commits to in a Trace, and productions
+// build their AST by reading the trace back once the whole match succeeds.
 namespace gs {
 
+class Trace
+{
+public:
+    struct Mark
+    {
+        std::size_t tokens;
+        std::size_t choices;
+    };
+
+public:
+    Mark mark() const
+    {
+        return { myTokens.size(), myChoices.size() };
+    }
+
+    // Forgets everything recorded since mark
+    void rewind(Mark const& mark)
+    {
+        myTokens.resize(mark.tokens);
+        myChoices.resize(mark.choices);
+    }
+
+    void token(kyfoo::lexer::Token const& token)
+    {
+        myTokens.push_back(token);
+    }
+
+    // Reserves a choice to be decided once the match is over
+    std::size_t choice()
+    {
+        myChoices.push_back(0);
+        return myChoices.size() - 1;
+    }
+
+    void choose(std::size_t slot, std::size_t value)
+    {
+        myChoices[slot] = value;
+    }
+
+    // Copies everything recorded since mark
+    Trace since(Mark const& mark) const
+    {
+        Trace ret;
+        ret.myTokens.assign(begin(myTokens) + mark.tokens, end(myTokens));
+        ret.myChoices.assign(begin(myChoices) + mark.choices, end(myChoices));
+        return ret;
+    }
+
+    void append(Trace const& rhs)
+    {
+        myTokens.insert(end(myTokens), begin(rhs.myTokens), end(rhs.myTokens));
+        myChoices.insert(end(myChoices), begin(rhs.myChoices), end(rhs.myChoices));
+    }
+
+private:
+    friend class Reader;
+
+    std::vector<kyfoo::lexer::Token> myTokens;
+    std::vector<std::size_t> myChoices;
+};
+
+// Reads a trace back in the order it was recorded
+class Reader
+{
+public:
+    explicit Reader(Trace const& trace)
+        : myTrace(trace)
+    {
+    }
+
+public:
+    kyfoo::lexer::Token const& token()
+    {
+        return myTrace.myTokens[myToken++];
+    }
+
+    std::size_t choice()
+    {
+        return myTrace.myChoices[myChoice++];
+    }
+
+private:
+    Trace const& myTrace;
+    std::size_t myToken = 0;
+    std::size_t myChoice = 0;
+};
+
+// Every match leaves the trace as it found it when it fails
+
 template <kyfoo::lexer::TokenKind K>
 struct Terminal
 {
-    static bool match(kyfoo::lexer::ScanPoint scan, std::size_t& matches)
+    static bool match(Trace& trace, kyfoo::lexer::ScanPoint scan)
     {
-        if ( scan.next().kind() != K)
+        KYFOO_GRAMMAR_PROBE(Terminal, scan);
+
+        if ( scan.peek().kind() != K )
             return false;
 
-        matches += 1;
+        trace.token(scan.next());
         return scan.commit();
     }
 
-    static kyfoo::lexer::Token capture(kyfoo::lexer::Scanner& scanner)
+    static kyfoo::lexer::Token const& token(Reader& reader)
     {
-        return scanner.next();
+        return reader.token();
+    }
+
+    static void skip(Reader& reader)
+    {
+        reader.token();
     }
 };
 
 template <typename... T>
 struct And
 {
-    static bool match(kyfoo::lexer::ScanPoint scan, std::size_t& matches)
+    static bool match(Trace& trace, kyfoo::lexer::ScanPoint scan)
     {
-        std::size_t m = 0;
-        if ( impl<T...>::match(scan, matches) ) {
-            matches += m;
+        KYFOO_GRAMMAR_PROBE(And, scan);
+
+        auto const mark = trace.mark();
+        if ( subMatch<0>(trace, scan) )
             return scan.commit();
-        }
 
+        trace.rewind(mark);
         return false;
     }
 
+    static void skip(Reader& reader)
+    {
+        subSkip<0>(reader);
+    }
+
 private:
-    template <typename Head, typename... Tail>
-    struct impl {
-        static bool match(kyfoo::lexer::ScanPoint& scan, std::size_t& matches)
-        {
-            std::size_t m = 0;
-            if ( Head::match(scan, m) && And<Tail...>::match(scan, matches) ) {
-                matches += m;
-                return true;
-            }
+    template <int N>
+    static bool subMatch(Trace& trace, kyfoo::lexer::ScanPoint& scan)
+    {
+        return factor_t<N>::match(trace, scan) && subMatch<N + 1>(trace, scan);
+    }
 
-            return false;
-        }
-    };
+    template <>
+    static bool subMatch<sizeof...(T)>(Trace&, kyfoo::lexer::ScanPoint&)
+    {
+        return true;
+    }
 
-    template <typename Head>
-    struct impl<Head>
+    template <int N>
+    static void subSkip(Reader& reader)
     {
-        static bool match(kyfoo::lexer::ScanPoint& scan, std::size_t& matches)
-        {
-            return Head::match(scan, matches);
-        }
-    };
+        factor_t<N>::skip(reader);
+        subSkip<N + 1>(reader);
+    }
+
+    template <>
+    static void subSkip<sizeof...(T)>(Reader&)
+    {
+        // nop
+    }
+
+private:
+    template <std::size_t N>
+    using factor_t = std::tuple_element_t<N, std::tuple<T...>>;
 };
 
 template <typename... T>
 struct Or
 {
-    static bool match(kyfoo::lexer::ScanPoint scan, std::size_t& matches)
+    static bool match(Trace& trace, kyfoo::lexer::ScanPoint scan)
     {
-        std::size_t m = 0;
-        if ( impl<T...>::match(scan, matches) ) {
-            matches += m;
+        KYFOO_GRAMMAR_PROBE(Or, scan);
+
+        auto const mark = trace.mark();
+        auto const slot = trace.choice();
+        if ( subMatch<0>(trace, scan, slot) )
             return scan.commit();
-        }
 
-        return impl<T...>::match(scan, matches);
+        trace.rewind(mark);
+        return false;
+    }
+
+    // Which alternative matched
+    static std::size_t index(Reader& reader)
+    {
+        return reader.choice();
+    }
+
+    static void skip(Reader& reader)
+    {
+        subSkip<0>(reader, index(reader));
     }
 
 private:
-    template <typename Head, typename... Tail>
-    struct impl {
-        static bool match(kyfoo::lexer::ScanPoint& scan, std::size_t& matches)
-        {
-            std::size_t m = 0;
-            if ( Head::match(scan, matches) ) {
-                matches += m;
-                return true;
+    template <int N>
+    static bool subMatch(Trace& trace, kyfoo::lexer::ScanPoint& scan, std::size_t slot)
+    {
+        // Alternatives that can't start here are not tried
+        if ( g::viable<term_t<N>>(scan) ) {
+            if ( N ) {
+                KYFOO_GRAMMAR_RESTART(Or);
+                scan.restart();
             }
 
-            scan.restart();
-            return impl<Tail...>::match(scan, matches);
+            if ( term_t<N>::match(trace, scan) ) {
+                trace.choose(slot, N);
+                return true;
+            }
         }
-    };
 
-    template <typename Head>
-    struct impl<Head> {
-        static bool match(kyfoo::lexer::ScanPoint scan, std::size_t& matches)
-        {
-            return Head::match(scan, matches);
-        }
-    };
+        return subMatch<N + 1>(trace, scan, slot);
+    }
+
+    template <>
+    static bool subMatch<sizeof...(T)>(Trace&, kyfoo::lexer::ScanPoint&, std::size_t)
+    {
+        return false;
+    }
+
+    template <int N>
+    static void subSkip(Reader& reader, std::size_t index)
+    {
+        if ( index == N )
+            term_t<N>::skip(reader);
+        else
+            subSkip<N + 1>(reader, index);
+    }
+
+    template <>
+    static void subSkip<sizeof...(T)>(Reader&, std::size_t)
+    {
+        // nop
+    }
+
+private:
+    template <std::size_t N>
+    using term_t = std::tuple_element_t<N, std::tuple<T...>>;
 };
 
-template <typename H, typename... T>
+template <typename... T>
 struct Long
 {
-    static bool match(kyfoo::lexer::ScanPoint scan,
-                      std::size_t& matches)
+    static bool match(Trace& trace, kyfoo::lexer::ScanPoint scan)
     {
+        KYFOO_GRAMMAR_PROBE(Long, scan);
+
+        auto const mark = trace.mark();
+        auto const slot = trace.choice();
+        auto const terms = trace.mark();
+        auto const position = scan.position();
+
         std::size_t longest = 0;
         std::size_t length = 0;
+        Trace best;
+        subMatch<0>(trace, scan, terms, position, longest, length, best);
 
-        impl<0, H, T...>::match(scan, longest, length);
-
-        if ( !length )
+        if ( !length ) {
+            trace.rewind(mark);
             return false;
+        }
 
-        impl<0, H, T...>::rematch(scan, matches, longest);
+        // Only the longest term's trace was kept, so committing it only has
+        // to move past the tokens it matched
+        KYFOO_GRAMMAR_RESTART(Long);
+        scan.restart();
+        scan.skip(length);
+        trace.choose(slot, longest);
+        trace.append(best);
         return scan.commit();
     }
 
+    static std::size_t index(Reader& reader)
+    {
+        return reader.choice();
+    }
+
+    static void skip(Reader& reader)
+    {
+        subSkip<0>(reader, index(reader));
+    }
+
 private:
-    template <std::size_t N, typename Head, typename... Tail>
-    struct impl {
-        static void match(kyfoo::lexer::ScanPoint& scan,
-                          std::size_t& longest,
-                          std::size_t& length)
-        {
-            std::size_t m = 0;
-            if ( Head::match(scan, m) && m > length ) {
-                longest = N;
-                length = m;
+    template <int N>
+    static void subMatch(Trace& trace,
+                         kyfoo::lexer::ScanPoint& scan,
+                         Trace::Mark const& mark,
+                         std::size_t position,
+                         std::size_t& longest,
+                         std::size_t& length,
+                         Trace& best)
+    {
+        if ( g::viable<term_t<N>>(scan) ) {
+            if ( N ) {
+                KYFOO_GRAMMAR_RESTART(Long);
+                scan.restart();
             }
 
-            impl<N + 1, Tail...>::match(scan, longest, length);
-        }
+            if ( term_t<N>::match(trace, scan) ) {
+                auto const m = scan.position() - position;
+                if ( m > length ) {
+                    longest = N;
+                    length = m;
+                    best = trace.since(mark);
+                }
 
-        static void rematch(kyfoo::lexer::ScanPoint& scan,
-                            std::size_t& matches,
-                            std::size_t n)
-        {
-            if ( n == N )
-                Head::match(scan, matches);
-            else
-                impl<N + 1, Tail...>::rematch(scan, matches, n);
-        }
-    };
-
-    template <std::size_t N, typename Head>
-    struct impl<N, Head> {
-        static void match(kyfoo::lexer::ScanPoint& scan,
-                          std::size_t& longest,
-                          std::size_t& length)
-        {
-            std::size_t m = 0;
-            if ( Head::match(scan, m) && m > length ) {
-                longest = N;
-                length = m;
+                trace.rewind(mark);
             }
         }
 
-        static void rematch(kyfoo::lexer::ScanPoint& scan,
-                            std::size_t& matches,
-                            std::size_t n)
-        {
-            if (n == N)
-                Head::match(scan, matches);
-        }
-    };
+        subMatch<N + 1>(trace, scan, mark, position, longest, length, best);
+    }
+
+    template <>
+    static void subMatch<sizeof...(T)>(Trace&,
+                                       kyfoo::lexer::ScanPoint&,
+                                       Trace::Mark const&,
+                                       std::size_t,
+                                       std::size_t&,
+                                       std::size_t&,
+                                       Trace&)
+    {
+        // nop
+    }
+
+    template <int N>
+    static void subSkip(Reader& reader, std::size_t index)
+    {
+        if ( index == N )
+            term_t<N>::skip(reader);
+        else
+            subSkip<N + 1>(reader, index);
+    }
+
+    template <>
+    static void subSkip<sizeof...(T)>(Reader&, std::size_t)
+    {
+        // nop
+    }
+
+private:
+    template <std::size_t N>
+    using term_t = std::tuple_element_t<N, std::tuple<T...>>;
 };
 
 template <typename T>
 struct Opt
 {
-    static bool match(kyfoo::lexer::ScanPoint scan, std::size_t& matches)
+    static bool match(Trace& trace, kyfoo::lexer::ScanPoint scan)
     {
-        if ( T::match(scan, matches) )
-            return scan.commit();
+        KYFOO_GRAMMAR_PROBE(Opt, scan);
 
-        return true;
+        auto const slot = trace.choice();
+        trace.choose(slot, T::match(trace, scan));
+        return scan.commit();
+    }
+
+    // Whether T matched, in which case it is read next
+    static bool present(Reader& reader)
+    {
+        return reader.choice() != 0;
+    }
+
+    static void skip(Reader& reader)
+    {
+        if ( present(reader) )
+            T::skip(reader);
     }
 };
 
 template <typename T>
 struct Repeat
 {
-    static bool match(kyfoo::lexer::ScanPoint scan, std::size_t& matches)
+    static bool match(Trace& trace, kyfoo::lexer::ScanPoint scan)
     {
-        std::size_t m = 0;
-        while ( T::match(scan, m) ) {
-            matches += m;
-            m = 0;
-        }
+        KYFOO_GRAMMAR_PROBE(Repeat, scan);
 
+        auto const slot = trace.choice();
+        std::size_t count = 0;
+        while ( T::match(trace, scan) )
+            ++count;
+
+        trace.choose(slot, count);
         return scan.commit();
     }
+
+    // Calls f to read each repetition
+    template <typename F>
+    static void each(Reader& reader, F&& f)
+    {
+        for ( auto n = reader.choice(); n; --n )
+            f(reader);
+    }
+
+    static void skip(Reader& reader)
+    {
+        each(reader, &T::skip);
+    }
 };
 
+template <typename U, typename V>
+struct OneOrMore2;
+
+// A separator matched without a following element is still consumed, so the
+// count of elements and separators is recorded rather than the elements alone
 template <typename U, typename V>
 struct Repeat2
 {
-    static bool match(kyfoo::lexer::ScanPoint scan, std::size_t& matches)
+    static bool match(Trace& trace, kyfoo::lexer::ScanPoint scan)
     {
-        std::size_t m0 = 0;
-        if ( U::match(scan, m0))
-            return scan.commit();
+        KYFOO_GRAMMAR_PROBE(Repeat2, scan);
 
-        matches += m0;
-        m0 = 0;
+        auto const slot = trace.choice();
+        trace.choose(slot, weave(trace, scan));
+        return scan.commit();
+    }
 
+    // Calls f to read each element, skipping separators
+    template <typename F>
+    static void each(Reader& reader, F&& f)
+    {
+        auto const n = reader.choice();
+        for ( std::size_t i = 0; i != n; ++i ) {
+            if ( i % 2 )
+                V::skip(reader);
+            else
+                f(reader);
+        }
+    }
+
+    static void skip(Reader& reader)
+    {
+        each(reader, &U::skip);
+    }
+
+private:
+    friend struct OneOrMore2<U, V>;
+
+    static std::size_t weave(Trace& trace, kyfoo::lexer::ScanPoint& scan)
+    {
+        if ( !U::match(trace, scan) )
+            return 0;
+
+        std::size_t count = 1;
         for (;;) {
-            m0 = 0;
-            std::size_t m1 = 0;
-            if ( !V::match(scan, m0) || !U::match(scan, m1) )
+            if ( !V::match(trace, scan) )
+                break;
+
+            ++count;
+            if ( !U::match(trace, scan) )
                 break;
 
-            matches += m0 + m1;
+            ++count;
         }
 
-        return scan.commit();
+        return count;
     }
 };
 
 template <typename T>
 struct OneOrMore
 {
-    static bool match(kyfoo::lexer::ScanPoint scan, std::size_t& matches)
+    static bool match(Trace& trace, kyfoo::lexer::ScanPoint scan)
     {
-        std::size_t m = 0;
-        if ( !T::match(scan, m) )
+        KYFOO_GRAMMAR_PROBE(OneOrMore, scan);
+
+        auto const mark = trace.mark();
+        auto const slot = trace.choice();
+        if ( !T::match(trace, scan) ) {
+            trace.rewind(mark);
             return false;
+        }
 
-        do {
-            matches += m;
-            m = 0;
-        } while (T::match(scan, m));
+        std::size_t count = 1;
+        while ( T::match(trace, scan) )
+            ++count;
 
+        trace.choose(slot, count);
         return scan.commit();
     }
+
+    template <typename F>
+    static void each(Reader& reader, F&& f)
+    {
+        Repeat<T>::each(reader, std::forward<F>(f));
+    }
+
+    static void skip(Reader& reader)
+    {
+        each(reader, &T::skip);
+    }
 };
 
 template <typename U, typename V>
 struct OneOrMore2
 {
-    static bool match(kyfoo::lexer::ScanPoint scan, std::size_t& matches)
+    static bool match(Trace& trace, kyfoo::lexer::ScanPoint scan)
     {
-        std::size_t m0 = 0;
-        if ( !U::match(scan, m) )
-            return false;
-
-        matches += m0;
-
-        for (;;) {
-            m0 = 0;
-            std::size_t m1 = 0;
-            if ( !V::match(scan, m0) || !U::match(scan, m1) )
-                break;
+        KYFOO_GRAMMAR_PROBE(OneOrMore2, scan);
 
-            matches += m0 + m1;
+        auto const mark = trace.mark();
+        auto const slot = trace.choice();
+        auto const count = Repeat2<U, V>::weave(trace, scan);
+        if ( !count ) {
+            trace.rewind(mark);
+            return false;
         }
 
+        trace.choose(slot, count);
         return scan.commit();
     }
+
+    template <typename F>
+    static void each(Reader& reader, F&& f)
+    {
+        Repeat2<U, V>::each(reader, std::forward<F>(f));
+    }
+
+    static void skip(Reader& reader)
+    {
+        each(reader, &U::skip);
+    }
 };
 
+// Lookahead
+
+template <kyfoo::lexer::TokenKind K>
+constexpr g::Lookahead lookahead(Terminal<K> const*)
+{
+    return { g::TokenSet(K), false };
+}
+
+template <typename... T>
+constexpr g::Lookahead lookahead(And<T...> const*)
+{
+    return g::sequence<T...>();
+}
+
+template <typename... T>
+constexpr g::Lookahead lookahead(Or<T...> const*)
+{
+    return g::choice<T...>();
+}
+
+template <typename... T>
+constexpr g::Lookahead lookahead(Long<T...> const*)
+{
+    return g::choice<T...>();
+}
+
+template <typename T>
+constexpr g::Lookahead lookahead(Opt<T> const*)
+{
+    return g::optional(g::lookahead<T>());
+}
+
+template <typename T>
+constexpr g::Lookahead lookahead(Repeat<T> const*)
+{
+    return g::optional(g::lookahead<T>());
+}
+
+template <typename U, typename V>
+constexpr g::Lookahead lookahead(Repeat2<U, V> const*)
+{
+    return g::optional(g::lookahead<U>());
+}
+
+template <typename T>
+constexpr g::Lookahead lookahead(OneOrMore<T> const*)
+{
+    return g::lookahead<T>();
+}
+
+template <typename U, typename V>
+constexpr g::Lookahead lookahead(OneOrMore2<U, V> const*)
+{
+    return g::lookahead<U>();
+}
+
+// Matches T at the scanner and builds its AST, or returns an empty result
+template <typename T>
+auto parse(kyfoo::lexer::Scanner& scanner)
+{
+    using result_t = decltype(T::make(std::declval<Reader&>()));
+
+    Trace trace;
+    if ( !T::match(trace, scanner) )
+        return result_t();
+
+    Reader reader(trace);
+    return T::make(reader);
+}
+
 } // namespace gs
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+#include <typeinfo>
+
+#include <kyfoo/lexer/Scanner.hpp>
+
+// Grammar instrumentation is opt-in: define KYFOO_GRAMMAR_STATS for every
+// translation unit to count matches per production. Without it the probes
+// below expand to nothing.
+
+namespace kyfoo {
+    namespace parser {
+
+struct ProductionStats
+{
+    explicit ProductionStats(char const* name)
+        : name(name)
+    {
+    }
+
+    char const* name;
+    std::atomic<std::uint64_t> attempts{ 0 };
+    std::atomic<std::uint64_t> successes{ 0 };
+    std::atomic<std::uint64_t> tokens{ 0 };
+    std::atomic<std::uint64_t> rollbacks{ 0 };
+};
+
+bool grammarStatsEnabled();
+void resetGrammarStats();
+void printGrammarStats(std::ostream& stream);
+
+#ifdef KYFOO_GRAMMAR_STATS
+
+ProductionStats& registerProduction(char const* name);
+
+template <typename T>
+ProductionStats& productionStats()
+{
+    static ProductionStats& stats = registerProduction(typeid(T).name());
+    return stats;
+}
+
+// Counts one match attempt of T. A scan point still open when the
+// attempt ends is rolled back; a committed one consumed its tokens.
+template <typename T>
+class ProductionProbe
+{
+public:
+    explicit ProductionProbe(lexer::ScanPoint const& scan)
+        : myScan(scan)
+        , myStart(scan.position())
+    {
+        productionStats<T>().attempts.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    ProductionProbe(ProductionProbe const&) = delete;
+    void operator = (ProductionProbe const&) = delete;
+
+    ~ProductionProbe()
+    {
+        auto& stats = productionStats<T>();
+        if ( myScan.open() ) {
+            stats.rollbacks.fetch_add(1, std::memory_order_relaxed);
+        }
+        else {
+            stats.successes.fetch_add(1, std::memory_order_relaxed);
+            stats.tokens.fetch_add(myScan.position() - myStart, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    lexer::ScanPoint const& myScan;
+    std::size_t myStart;
+};
+
+#define KYFOO_GRAMMAR_PROBE(T, scan) ::kyfoo::parser::ProductionProbe<T> grammarProbe_(scan)
+
+// Or and Long also roll back when restarting between alternatives
+#define KYFOO_GRAMMAR_RESTART(T) ::kyfoo::parser::productionStats<T>().rollbacks.fetch_add(1, std::memory_order_relaxed)
+
+#else
+
+#define KYFOO_GRAMMAR_PROBE(T, scan)
+#define KYFOO_GRAMMAR_RESTART(T)
+
+#endif
+
+    } // namespace parser
+} // namespace kyfoo
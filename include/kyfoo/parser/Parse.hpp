@@ -21,6 +21,12 @@ namespace kyfoo {
 
     namespace parser {
 
+enum class GrammarKind
+{
+    Stateful,   // g, productions capture into themselves as they match
+    Stateless,  // gs, matches are traced and built once a declaration commits
+};
+
 class DataSumScopeParser;
 class DataProductScopeParser;
 class ProcedureScopeParser;
@@ -49,6 +55,7 @@ protected:
 
 protected:
     ast::DeclarationScope* myScope = nullptr;
+    GrammarKind myGrammar = GrammarKind::Stateful;
 };
 
 class DataSumScopeParser : public DeclarationScopeParser
@@ -55,10 +55,15 @@ public:
     std::unique_ptr<ast::Expression> make() const;
 
 private:
+    // Matched grammars live in the scanner's capture arena and are never
+    // modified again, so copies and the memo share them
     struct impl;
-    std::unique_ptr<impl> myGrammar;
+    impl const* myGrammar = nullptr;
 };
 
+// Expression is recursive, so its lookahead is spelled out below
+constexpr g::Lookahead lookahead(Expression const*);
+
 inline std::vector<std::unique_ptr<ast::Expression>>
 expressions(std::vector<Expression> const& rhs)
 {
@@ -160,6 +165,12 @@ struct Tuple : public
     }
 };
 
+// Leading part of Expression::impl
+constexpr g::Lookahead lookahead(Expression const*)
+{
+    return g::lookahead<g::OneOrMore<g::Or<Tuple, Primary>>>();
+}
+
 struct Symbol : public
     g::Or<
           g::And<id, g::Opt<TupleSymbol>>
@@ -0,0 +1,272 @@
+#pragma once
+
+#include <kyfoo/parser/GrammarStatic.hpp>
+#include <kyfoo/parser/Productions.hpp>
+
+namespace kyfoo {
+    namespace parser {
+        namespace stateless {
+
+// Mirrors the productions in Productions.hpp over the gs combinators. Each
+// make reads back what its match recorded, in the same order.
+
+using id = gs::Terminal<TokenKind::Identifier>;
+using free = gs::Terminal<TokenKind::FreeVariable>;
+using integer = gs::Terminal<TokenKind::Integer>;
+using decimal = gs::Terminal<TokenKind::Decimal>;
+using string = gs::Terminal<TokenKind::String>;
+using comma = gs::Terminal<TokenKind::Comma>;
+using equal = gs::Terminal<TokenKind::Equal>;
+using colon = gs::Terminal<TokenKind::Colon>;
+using colonPipe = gs::Terminal<TokenKind::ColonPipe>;
+using colonAmpersand = gs::Terminal<TokenKind::AmpersandPipe>;
+using yield = gs::Terminal<TokenKind::Yield>;
+using openParen = gs::Terminal<TokenKind::OpenParen>;
+using closeParen = gs::Terminal<TokenKind::CloseParen>;
+using openBracket = gs::Terminal<TokenKind::OpenBracket>;
+using closeBracket = gs::Terminal<TokenKind::CloseBracket>;
+using openAngle = gs::Terminal<TokenKind::OpenAngle>;
+using closeAngle = gs::Terminal<TokenKind::CloseAngle>;
+using _import = gs::Terminal<TokenKind::_import>;
+
+struct Primary : public
+    gs::Or<id, free, integer, decimal, string>
+{
+    static std::unique_ptr<ast::PrimaryExpression> make(gs::Reader& reader)
+    {
+        index(reader);
+        return std::make_unique<ast::PrimaryExpression>(reader.token());
+    }
+};
+
+struct Expression
+{
+    static bool match(gs::Trace& trace, lexer::ScanPoint scan);
+    static std::unique_ptr<ast::Expression> make(gs::Reader& reader);
+
+    struct impl;
+};
+
+// Expression is recursive, so its lookahead is spelled out below
+constexpr g::Lookahead lookahead(Expression const*);
+
+// Reads the expressions matched by T, which repeats Expression
+template <typename T>
+std::vector<std::unique_ptr<ast::Expression>> expressions(gs::Reader& reader)
+{
+    std::vector<std::unique_ptr<ast::Expression>> ret;
+    T::each(reader, [&ret](gs::Reader& r) { ret.emplace_back(Expression::make(r)); });
+    return ret;
+}
+
+template <TokenKind Open, TokenKind Close>
+struct TupleOf : public
+    gs::And<gs::Terminal<Open>, gs::Repeat2<Expression, comma>, gs::Terminal<Close>>
+{
+    static std::unique_ptr<ast::TupleExpression> make(gs::Reader& reader)
+    {
+        auto const& open = reader.token();
+        auto e = expressions<gs::Repeat2<Expression, comma>>(reader);
+        return createTuple(open, reader.token(), std::move(e));
+    }
+};
+
+using TupleOpen = TupleOf<TokenKind::OpenParen, TokenKind::CloseParen>;
+using TupleOpenRight = TupleOf<TokenKind::OpenBracket, TokenKind::CloseParen>;
+using TupleOpenLeft = TupleOf<TokenKind::OpenParen, TokenKind::CloseBracket>;
+using TupleClosed = TupleOf<TokenKind::OpenBracket, TokenKind::CloseBracket>;
+
+struct TupleSymbol : public
+    gs::And<gs::Opt<id>, openAngle, gs::Repeat2<Expression, comma>, closeAngle>
+{
+    static std::unique_ptr<ast::SymbolExpression> make(gs::Reader& reader)
+    {
+        lexer::Token name;
+        auto const named = gs::Opt<id>::present(reader);
+        if ( named )
+            name = reader.token();
+
+        auto const& open = reader.token();
+        auto e = expressions<gs::Repeat2<Expression, comma>>(reader);
+        auto const& close = reader.token();
+        if ( named )
+            return std::make_unique<ast::SymbolExpression>(name, std::move(e));
+
+        return std::make_unique<ast::SymbolExpression>(open, close, std::move(e));
+    }
+};
+
+struct Tuple : public
+    gs::Or<TupleOpen, TupleOpenLeft, TupleOpenRight, TupleClosed, TupleSymbol>
+{
+    static std::unique_ptr<ast::Expression> make(gs::Reader& reader)
+    {
+        switch (index(reader)) {
+        case 0: return TupleOpen::make(reader);
+        case 1: return TupleOpenLeft::make(reader);
+        case 2: return TupleOpenRight::make(reader);
+        case 3: return TupleClosed::make(reader);
+        case 4: return TupleSymbol::make(reader);
+        default:
+            throw std::runtime_error("invalid tuple expression");
+        }
+    }
+};
+
+// Leading part of Expression::impl
+constexpr g::Lookahead lookahead(Expression const*)
+{
+    return g::lookahead<gs::OneOrMore<gs::Or<Tuple, Primary>>>();
+}
+
+struct Symbol : public
+    gs::Or<
+           gs::And<id, gs::Opt<TupleSymbol>>
+         , TupleSymbol
+          >
+{
+    static ast::Symbol make(gs::Reader& reader)
+    {
+        switch (index(reader)) {
+        case 0:
+        {
+            auto const& name = reader.token();
+            if ( gs::Opt<TupleSymbol>::present(reader) )
+                return ast::Symbol(name, std::move(TupleSymbol::make(reader)->internalExpressions()));
+            else
+                return ast::Symbol(name);
+        }
+
+        case 1:
+            return ast::Symbol(lexer::Token(), std::move(TupleSymbol::make(reader)->internalExpressions()));
+
+        default:
+            throw std::runtime_error("invalid symbol expression");
+        }
+    }
+};
+
+// id : Expression
+using Binding = gs::And<id, colon, Expression>;
+
+struct ProcedureDeclaration : public
+    gs::And<
+        Symbol,
+        openParen,
+        gs::Repeat2<Binding, comma>,
+        closeParen,
+        gs::Opt<gs::And<colon, Expression>>>
+{
+    static std::unique_ptr<ast::ProcedureDeclaration> make(gs::Reader& reader)
+    {
+        auto symbol = Symbol::make(reader);
+        reader.token();
+
+        std::vector<std::unique_ptr<ast::ProcedureParameter>> parameters;
+        gs::Repeat2<Binding, comma>::each(reader, [&parameters](gs::Reader& r) {
+            auto const& name = r.token();
+            r.token();
+            parameters.emplace_back(
+                std::make_unique<ast::ProcedureParameter>(ast::Symbol(name), Expression::make(r)));
+        });
+
+        reader.token();
+
+        std::unique_ptr<ast::Expression> returnTypeExpression;
+        if ( gs::Opt<gs::And<colon, Expression>>::present(reader) ) {
+            reader.token();
+            returnTypeExpression = Expression::make(reader);
+        }
+
+        return std::make_unique<ast::ProcedureDeclaration>(std::move(symbol),
+                                                           std::move(parameters),
+                                                           std::move(returnTypeExpression));
+    }
+};
+
+struct SymbolDeclaration : public
+    gs::And<Symbol, equal, Expression>
+{
+    static std::unique_ptr<ast::SymbolDeclaration> make(gs::Reader& reader)
+    {
+        auto symbol = Symbol::make(reader);
+        reader.token();
+        return std::make_unique<ast::SymbolDeclaration>(std::move(symbol), Expression::make(reader));
+    }
+};
+
+struct ImportDeclaration : public
+    gs::And<_import, id>
+{
+    static std::unique_ptr<ast::ImportDeclaration> make(gs::Reader& reader)
+    {
+        reader.token();
+        return std::make_unique<ast::ImportDeclaration>(ast::Symbol(reader.token()));
+    }
+};
+
+struct DataSumDeclaration : public
+    gs::And<colonPipe, Symbol>
+{
+    static std::unique_ptr<ast::DataSumDeclaration> make(gs::Reader& reader)
+    {
+        reader.token();
+        return std::make_unique<ast::DataSumDeclaration>(Symbol::make(reader));
+    }
+};
+
+struct DataSumConstructor : public
+    gs::And<Symbol, gs::Opt<gs::And<openParen, gs::Repeat2<Binding, comma>, closeParen>>>
+{
+    static std::unique_ptr<ast::DataSumDeclaration::Constructor> make(gs::Reader& reader)
+    {
+        auto symbol = Symbol::make(reader);
+
+        std::vector<std::unique_ptr<ast::VariableDeclaration>> parameters;
+        if ( gs::Opt<gs::And<openParen, gs::Repeat2<Binding, comma>, closeParen>>::present(reader) ) {
+            reader.token();
+            gs::Repeat2<Binding, comma>::each(reader, [&parameters](gs::Reader& r) {
+                auto const& name = r.token();
+                r.token();
+                parameters.emplace_back(
+                    std::make_unique<ast::VariableDeclaration>(ast::Symbol(name), Expression::make(r), nullptr));
+            });
+            reader.token();
+        }
+
+        return std::make_unique<ast::DataSumDeclaration::Constructor>(std::move(symbol), std::move(parameters));
+    }
+};
+
+struct DataProductDeclaration : public
+    gs::And<colonAmpersand, Symbol>
+{
+    static std::unique_ptr<ast::DataProductDeclaration> make(gs::Reader& reader)
+    {
+        reader.token();
+        return std::make_unique<ast::DataProductDeclaration>(Symbol::make(reader));
+    }
+};
+
+struct DataProductDeclarationField : public
+    gs::And<id, colon, Expression, gs::Opt<gs::And<equal, Expression>>>
+{
+    static std::unique_ptr<ast::VariableDeclaration> make(gs::Reader& reader)
+    {
+        auto const& name = reader.token();
+        reader.token();
+        auto type = Expression::make(reader);
+
+        std::unique_ptr<ast::Expression> init;
+        if ( gs::Opt<gs::And<equal, Expression>>::present(reader) ) {
+            reader.token();
+            init = Expression::make(reader);
+        }
+
+        return std::make_unique<ast::VariableDeclaration>(ast::Symbol(name), std::move(type), std::move(init));
+    }
+};
+
+        } // namespace stateless
+    } // namespace parser
+} // namespace kyfoo
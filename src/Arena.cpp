@@ -0,0 +1,67 @@
+#include <kyfoo/Arena.hpp>
+
+#include <algorithm>
+
+namespace kyfoo {
+
+Arena::Arena(std::size_t blockSize)
+    : myBlockSize(blockSize)
+{
+}
+
+Arena::~Arena()
+{
+    reset();
+}
+
+void* Arena::allocate(std::size_t size, std::size_t alignment)
+{
+    if ( !myBlocks.empty() ) {
+        auto const offset = (myOffset + alignment - 1) & ~(alignment - 1);
+        if ( offset + size <= myBlocks[myBlock].size ) {
+            myOffset = offset + size;
+            return myBlocks[myBlock].data.get() + offset;
+        }
+    }
+
+    // Move on to the next block, keeping any that a rewind left behind
+    // unless it is too small for this request
+    auto const next = myBlocks.empty() ? 0 : myBlock + 1;
+    if ( next == myBlocks.size() || myBlocks[next].size < size ) {
+        auto const blockSize = std::max(myBlockSize, size);
+        myBlocks.insert(begin(myBlocks) + next, Block{ std::unique_ptr<char[]>(new char[blockSize]), blockSize });
+    }
+
+    // Blocks come from new[], which is aligned for any fundamental type
+    myBlock = next;
+    myOffset = size;
+    return myBlocks[myBlock].data.get();
+}
+
+void Arena::rewind(Mark const& mark)
+{
+    while ( myDestructors.size() > mark.destructors ) {
+        auto const& d = myDestructors.back();
+        d.destroy(d.object);
+        myDestructors.pop_back();
+    }
+
+    myBlock = mark.block;
+    myOffset = mark.offset;
+}
+
+void Arena::reset()
+{
+    rewind({ 0, 0, 0 });
+}
+
+std::size_t Arena::capacity() const
+{
+    std::size_t ret = 0;
+    for ( auto const& b : myBlocks )
+        ret += b.size;
+
+    return ret;
+}
+
+} // namespace kyfoo
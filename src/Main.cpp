@@ -1,20 +1,32 @@
+#include <algorithm>
+#include <condition_variable>
 #include <iomanip>
 #include <iostream>
 #include <fstream>
 #include <filesystem>
+#include <map>
+#include <mutex>
 #include <queue>
+#include <random>
 #include <set>
+#include <sstream>
+#include <thread>
 #include <vector>
 
 #include <kyfoo/Diagnostics.hpp>
 
+#include <kyfoo/lexer/CharScan.hpp>
 #include <kyfoo/lexer/Scanner.hpp>
+#include <kyfoo/lexer/SourceBuffer.hpp>
 
+#include <kyfoo/parser/GrammarStats.hpp>
 #include <kyfoo/parser/Parse.hpp>
 
 #include <kyfoo/ast/Axioms.hpp>
 #include <kyfoo/ast/Module.hpp>
 #include <kyfoo/ast/Node.hpp>
+#include <kyfoo/ast/OverloadStats.hpp>
+#include <kyfoo/ast/Scopes.hpp>
 #include <kyfoo/ast/Semantics.hpp>
 
 #include <kyfoo/codegen/Codegen.hpp>
@@ -24,13 +36,15 @@ namespace fs = std::experimental::filesystem;
 
 int runScannerDump(fs::path const& file)
 {
-    std::ifstream fin(file);
-    kyfoo::lexer::Scanner scanner(fin);
-    if ( !scanner ) {
+    auto source = kyfoo::lexer::SourceBuffer::fromFile(file);
+    if ( !source ) {
         std::cout << "could not open file: " << file << std::endl;
         return EXIT_FAILURE;
     }
 
+    kyfoo::lexer::InternTable interns;
+    kyfoo::lexer::Scanner scanner(*source, interns);
+
     while (scanner)
     {
         auto token = scanner.next();
@@ -56,41 +70,828 @@ int runScannerDump(fs::path const& file)
             std::cout << '\'' << token.lexeme() << "'\n";
             break;
 
-        default:
-            std::cout << token.lexeme() << " : " << to_string(token.kind()) << '\n';
-        }
+        default:
+            std::cout << token.lexeme() << " : " << to_string(token.kind()) << '\n';
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+std::vector<kyfoo::lexer::Token> scanAll(kyfoo::lexer::SourceBuffer const& source,
+                                         kyfoo::lexer::ScanMode mode)
+{
+    kyfoo::lexer::InternTable interns;
+    kyfoo::lexer::Scanner scanner(source, interns, mode);
+
+    std::vector<kyfoo::lexer::Token> ret;
+    while ( scanner )
+        ret.push_back(scanner.next());
+
+    return ret;
+}
+
+bool sameTokens(fs::path const& file,
+                const char* what,
+                std::vector<kyfoo::lexer::Token> const& expected,
+                std::vector<kyfoo::lexer::Token> const& actual)
+{
+    auto const n = std::min(expected.size(), actual.size());
+    std::size_t i = 0;
+    for ( ; i != n; ++i ) {
+        auto const& e = expected[i];
+        auto const& a = actual[i];
+        if ( e.kind() != a.kind()
+          || e.offset() != a.offset()
+          || e.length() != a.length()
+          || e.id() != a.id() )
+        {
+            break;
+        }
+    }
+
+    if ( i == n && expected.size() == actual.size() )
+        return true;
+
+    std::cout << file.string() << ": " << what << " differs at token " << i << '\n';
+    if ( i != n )
+        std::cout << "    expected " << to_string(expected[i].kind()) << " '" << expected[i].lexeme() << "'"
+                  << ", got " << to_string(actual[i].kind()) << " '" << actual[i].lexeme() << "'\n";
+
+    return false;
+}
+
+// Reads past the end of the source inside a scan and rolls it back. The
+// position must return to where the scan began, since memo keys use it
+bool rollsBackAtEnd(fs::path const& file,
+                    kyfoo::lexer::SourceBuffer const& source,
+                    kyfoo::lexer::ScanMode mode,
+                    const char* what)
+{
+    kyfoo::lexer::InternTable interns;
+    kyfoo::lexer::Scanner scanner(source, interns, mode);
+
+    auto const savePoint = scanner.beginScan();
+    auto const position = scanner.position();
+    while ( scanner.next().kind() != kyfoo::lexer::TokenKind::EndOfFile )
+        ;
+
+    scanner.next();
+    scanner.rollbackScan(savePoint);
+    if ( scanner.position() == position )
+        return true;
+
+    std::cout << file.string() << ": " << what << " position moved after rolling back past the end\n";
+    return false;
+}
+
+// Looks a token up after its buffer is gone, which must throw rather than
+// answer from the buffer registered next
+bool failsAfterRelease(fs::path const& file, kyfoo::lexer::SourceBuffer const& source)
+{
+    kyfoo::lexer::InternTable interns;
+    kyfoo::lexer::Token token;
+    {
+        kyfoo::lexer::SourceBuffer scanned(source.text());
+        kyfoo::lexer::Scanner scanner(scanned, interns, kyfoo::lexer::ScanMode::Stream);
+        token = scanner.next();
+    }
+
+    kyfoo::lexer::SourceBuffer next(source.text());
+    try {
+        token.lexeme();
+    }
+    catch (std::runtime_error const&) {
+        return true;
+    }
+
+    std::cout << file.string() << ": token was looked up after its buffer was released\n";
+    return false;
+}
+
+// Scans each file with every supported character scanner, and with the
+// tokenized scanner, and compares the token streams against the scalar one.
+// Also checks that both scan modes roll back cleanly at the end of input, and
+// that tokens outliving their buffer fail
+int runScannerCheck(std::vector<fs::path> const& files)
+{
+    using kyfoo::lexer::CharScanIsa;
+    using kyfoo::lexer::ScanMode;
+
+    auto const original = kyfoo::lexer::charScanIsa();
+    auto const best = kyfoo::lexer::detectCharScanIsa();
+
+    int ret = EXIT_SUCCESS;
+    for ( auto const& file : files ) {
+        auto source = kyfoo::lexer::SourceBuffer::fromFile(file);
+        if ( !source ) {
+            std::cout << "could not open file: " << file << std::endl;
+            ret = EXIT_FAILURE;
+            continue;
+        }
+
+        kyfoo::lexer::setCharScanIsa(CharScanIsa::Scalar);
+        auto const expected = scanAll(*source, ScanMode::Stream);
+
+        for ( auto isa = CharScanIsa::SSE2; isa <= best; isa = CharScanIsa(int(isa) + 1) ) {
+            kyfoo::lexer::setCharScanIsa(isa);
+            if ( !sameTokens(file, to_string(isa), expected, scanAll(*source, ScanMode::Stream)) )
+                ret = EXIT_FAILURE;
+        }
+
+        kyfoo::lexer::setCharScanIsa(original);
+        if ( !sameTokens(file, "tokenized", expected, scanAll(*source, ScanMode::Tokenized)) )
+            ret = EXIT_FAILURE;
+
+        if ( !rollsBackAtEnd(file, *source, ScanMode::Stream, "stream")
+          || !rollsBackAtEnd(file, *source, ScanMode::Tokenized, "tokenized") )
+        {
+            ret = EXIT_FAILURE;
+        }
+
+        if ( !failsAfterRelease(file, *source) )
+            ret = EXIT_FAILURE;
+    }
+
+    return ret;
+}
+
+int runParserTest(fs::path const& filepath, bool stats, kyfoo::parser::GrammarKind grammar)
+{
+    if ( stats && !kyfoo::parser::grammarStatsEnabled() ) {
+        kyfoo::parser::printGrammarStats(std::cout);
+        return EXIT_FAILURE;
+    }
+
+    kyfoo::Diagnostics dgn;
+    kyfoo::ast::ModuleSet moduleSet;
+    moduleSet.setGrammar(grammar);
+    auto main = moduleSet.create(filepath);
+    try {
+        if ( stats ) {
+            // Serially, so chunk fallbacks don't count twice
+            kyfoo::parser::resetGrammarStats();
+            main->parse(dgn);
+            kyfoo::parser::printGrammarStats(std::cout);
+        }
+        else {
+            main->parse(dgn, std::thread::hardware_concurrency());
+            kyfoo::ast::JsonOutput output(std::cout);
+            main->io(output);
+        }
+    }
+    catch (kyfoo::Diagnostics*) {
+        // Handled below
+    }
+    catch (std::exception const& e) {
+        std::cout << filepath << ": ICE: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    dgn.dumpErrors(std::cout);
+
+    if ( dgn.errorCount() )
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+// Parses text as a module with the given grammar, returning its JSON tree or
+// diagnostics
+std::string parseOutput(std::string const& name,
+                        std::string const& text,
+                        kyfoo::parser::GrammarKind grammar)
+{
+    std::ostringstream out;
+    kyfoo::Diagnostics dgn;
+    kyfoo::ast::ModuleSet moduleSet;
+    moduleSet.setGrammar(grammar);
+    auto m = moduleSet.create(name);
+    try {
+        m->parse(dgn, std::make_unique<kyfoo::lexer::SourceBuffer>(std::string_view(text)));
+        kyfoo::ast::JsonOutput output(out);
+        m->io(output);
+    }
+    catch (kyfoo::Diagnostics*) {
+        // Handled below
+    }
+    catch (std::exception const& e) {
+        out << "ICE: " << e.what() << '\n';
+    }
+
+    dgn.dumpErrors(out);
+    return out.str();
+}
+
+bool sameParse(std::string const& name, std::string const& text)
+{
+    using kyfoo::parser::GrammarKind;
+
+    auto const expected = parseOutput(name, text, GrammarKind::Stateful);
+    auto const actual = parseOutput(name, text, GrammarKind::Stateless);
+    if ( expected == actual )
+        return true;
+
+    auto const n = std::mismatch(begin(expected), end(expected), begin(actual), end(actual)).first - begin(expected);
+    auto const line = std::count(begin(expected), begin(expected) + n, '\n') + 1;
+    std::cout << name << ": stateless parse differs at output line " << line << '\n';
+    return false;
+}
+
+// Writes random modules over the whole grammar. Some are given a stray
+// token so that failed parses are compared as well.
+class ModuleGenerator
+{
+public:
+    explicit ModuleGenerator(unsigned seed)
+        : myRandom(seed)
+    {
+    }
+
+public:
+    std::string module()
+    {
+        myText.clear();
+        auto const n = 1 + pick(6);
+        for ( std::size_t i = 0; i != n; ++i )
+            declaration(0, true);
+
+        if ( !pick(8) ) {
+            static char const* const strays[] = { ")", "]", ">", ",", ":", "=", "=>", ":|" };
+            myText.insert(pick(myText.size() + 1), std::string(" ") + strays[pick(8)] + " ");
+        }
+
+        return myText;
+    }
+
+private:
+    std::size_t pick(std::size_t n)
+    {
+        return std::uniform_int_distribution<std::size_t>(0, n - 1)(myRandom);
+    }
+
+    void line(int indent)
+    {
+        myText += '\n';
+        myText.append(4 * indent, ' ');
+    }
+
+    void name()
+    {
+        static char const* const names[] = { "x", "y", "f", "g", "add", "T", "ptr", "array" };
+        myText += names[pick(8)];
+    }
+
+    void primary()
+    {
+        switch (pick(6)) {
+        case 0: myText += "\\T"; break;
+        case 1: myText += "42"; break;
+        case 2: myText += "2.5"; break;
+        case 3: myText += "\"s\""; break;
+        default: name(); break;
+        }
+    }
+
+    void elements(int depth)
+    {
+        auto const n = pick(4);
+        for ( std::size_t i = 0; i != n; ++i ) {
+            if ( i )
+                myText += ", ";
+
+            expression(depth + 1);
+        }
+
+        if ( n && !pick(10) )
+            myText += ",";
+    }
+
+    void tuple(int depth)
+    {
+        static char const* const opens[] = { "(", "[" };
+        static char const* const closes[] = { ")", "]" };
+        if ( pick(3) ) {
+            myText += opens[pick(2)];
+            elements(depth);
+            myText += closes[pick(2)];
+        }
+        else {
+            symbolTuple(depth, pick(2) != 0);
+        }
+    }
+
+    void symbolTuple(int depth, bool named)
+    {
+        if ( named )
+            name();
+
+        myText += "<";
+        elements(depth);
+        myText += ">";
+    }
+
+    void expression(int depth)
+    {
+        auto const n = 1 + pick(depth > 3 ? 1 : 3);
+        for ( std::size_t i = 0; i != n; ++i ) {
+            if ( i )
+                myText += " ";
+
+            if ( depth < 4 && !pick(3) )
+                tuple(depth);
+            else
+                primary();
+        }
+
+        if ( depth < 4 && !pick(6) ) {
+            myText += " : ";
+            expression(depth + 1);
+        }
+    }
+
+    void symbol()
+    {
+        if ( !pick(6) ) {
+            symbolTuple(2, false);
+            return;
+        }
+
+        name();
+        if ( !pick(3) )
+            symbolTuple(2, false);
+    }
+
+    void bindings()
+    {
+        auto const n = pick(3);
+        for ( std::size_t i = 0; i != n; ++i ) {
+            if ( i )
+                myText += ", ";
+
+            name();
+            myText += " : ";
+            expression(2);
+        }
+    }
+
+    void declaration(int indent, bool topLevel)
+    {
+        line(indent);
+        switch (pick(topLevel ? 6 : 4)) {
+        case 0:
+            symbol();
+            myText += " = ";
+            expression(0);
+            break;
+
+        case 1:
+        case 2:
+            symbol();
+            myText += "(";
+            bindings();
+            myText += ")";
+            if ( !pick(3) ) {
+                myText += " : ";
+                expression(1);
+            }
+
+            if ( pick(2) ) {
+                myText += " =>";
+                if ( indent < 2 && pick(2) ) {
+                    auto const n = 1 + pick(3);
+                    for ( std::size_t i = 0; i != n; ++i ) {
+                        if ( pick(4) ) {
+                            line(indent + 1);
+                            expression(0);
+                        }
+                        else {
+                            declaration(indent + 1, false);
+                        }
+                    }
+                }
+                else {
+                    myText += " ";
+                    expression(0);
+                }
+            }
+            break;
+
+        case 3:
+            myText += ":| ";
+            symbol();
+            for ( auto n = pick(3); n; --n ) {
+                line(indent + 1);
+                symbol();
+                if ( pick(2) ) {
+                    myText += "(";
+                    bindings();
+                    myText += ")";
+                }
+            }
+            break;
+
+        case 4:
+            myText += ":& ";
+            symbol();
+            for ( auto n = pick(3); n; --n ) {
+                line(indent + 1);
+                name();
+                myText += " : ";
+                expression(1);
+                if ( !pick(3) ) {
+                    myText += " = ";
+                    expression(1);
+                }
+            }
+            break;
+
+        case 5:
+            myText += "import ";
+            name();
+            break;
+        }
+    }
+
+private:
+    std::mt19937 myRandom;
+    std::string myText;
+};
+
+// Parses each file, and count generated modules, with both grammars and
+// compares their trees and diagnostics
+int runParserCheck(std::vector<fs::path> const& files, std::size_t count)
+{
+    int ret = EXIT_SUCCESS;
+    for ( auto const& file : files ) {
+        std::ifstream fin(file);
+        if ( !fin ) {
+            std::cout << "could not open file: " << file << std::endl;
+            ret = EXIT_FAILURE;
+            continue;
+        }
+
+        std::ostringstream text;
+        text << fin.rdbuf();
+        if ( !sameParse(file.string(), text.str()) )
+            ret = EXIT_FAILURE;
+    }
+
+    ModuleGenerator generator(std::mt19937::default_seed);
+    for ( std::size_t i = 0; i != count; ++i ) {
+        auto const text = generator.module();
+        if ( !sameParse("generated" + std::to_string(i), text) ) {
+            std::cout << text << '\n';
+            ret = EXIT_FAILURE;
+        }
+    }
+
+    return ret;
+}
+
+struct SourceEdit
+{
+    kyfoo::lexer::source_offset_t first;
+    kyfoo::lexer::source_offset_t last;
+    std::string text;
+};
+
+// Applies each edit with Module::reparse, comparing the tree and diagnostics
+// after every one against a full parse of the edited text
+bool sameReparse(std::string const& name, std::string text, std::vector<SourceEdit> const& edits)
+{
+    kyfoo::ast::ModuleSet moduleSet;
+    auto m = moduleSet.create(name);
+    try {
+        kyfoo::Diagnostics dgn;
+        m->parse(dgn, std::make_unique<kyfoo::lexer::SourceBuffer>(std::string(text)));
+    }
+    catch (kyfoo::Diagnostics*) {
+        // Compared after the first edit
+    }
+
+    for ( std::size_t i = 0; i != edits.size(); ++i ) {
+        auto const& edit = edits[i];
+        text.replace(edit.first, edit.last - edit.first, edit.text);
+
+        std::ostringstream out;
+        kyfoo::Diagnostics dgn;
+        try {
+            m->reparse(dgn, edit.first, edit.last, edit.text);
+            kyfoo::ast::JsonOutput output(out);
+            m->io(output);
+        }
+        catch (kyfoo::Diagnostics*) {
+            // Handled below
+        }
+        catch (std::exception const& e) {
+            out << "ICE: " << e.what() << '\n';
+        }
+
+        dgn.dumpErrors(out);
+        if ( out.str() != parseOutput(name, text, kyfoo::parser::GrammarKind::Stateful) ) {
+            std::cout << name << ": reparse differs from a full parse after edit " << i
+                      << " [" << edit.first << ", " << edit.last << ") '" << edit.text << "'\n";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Reparses a fixed case where an edit leaves the text unparsable, and count
+// random small edits to each file, checking each against a full parse
+int runReparseCheck(std::vector<fs::path> const& files, std::size_t count)
+{
+    int ret = EXIT_SUCCESS;
+    if ( !sameReparse("unbalanced", "a = 1\nb = 2\nc = 3\n", { { 10, 10, "(" }, { 12, 12, ")" } }) )
+        ret = EXIT_FAILURE;
+
+    std::mt19937 random(std::mt19937::default_seed);
+    auto pick = [&random](std::size_t n) {
+        return std::uniform_int_distribution<std::size_t>(0, n - 1)(random);
+    };
+
+    for ( auto const& file : files ) {
+        std::ifstream fin(file);
+        if ( !fin ) {
+            std::cout << "could not open file: " << file << std::endl;
+            ret = EXIT_FAILURE;
+            continue;
+        }
+
+        std::ostringstream text;
+        text << fin.rdbuf();
+
+        // Inserts or deletes a few characters at a time
+        static char const* const inserts[] = { "x", " ", "\n", "(", ")", "=", "\n    " };
+        std::vector<SourceEdit> edits;
+        auto size = text.str().size();
+        for ( std::size_t i = 0; i != count; ++i ) {
+            auto const first = pick(size + 1);
+            if ( pick(2) ) {
+                std::string const insert = inserts[pick(7)];
+                edits.push_back({ static_cast<kyfoo::lexer::source_offset_t>(first),
+                                  static_cast<kyfoo::lexer::source_offset_t>(first),
+                                  insert });
+                size += insert.size();
+            }
+            else {
+                auto const last = std::min(size, first + pick(3));
+                edits.push_back({ static_cast<kyfoo::lexer::source_offset_t>(first),
+                                  static_cast<kyfoo::lexer::source_offset_t>(last),
+                                  "" });
+                size -= last - first;
+            }
+        }
+
+        if ( !sameReparse(file.string(), text.str(), edits) )
+            ret = EXIT_FAILURE;
+    }
+
+    return ret;
+}
+
+// Dispatches by trying as<T>() for each kind in turn, as ShallowApply did
+// before it switched on kind(). Kept for visitbench.
+template <template<class> typename Op>
+class IfChainApply
+{
+public:
+    using operator_t = Op<IfChainApply>;
+
+    IfChainApply()
+        : myOperator(*this)
+    {
+    }
+
+    typename operator_t::result_t operator()(kyfoo::ast::Expression const& expr)
+    {
+        using namespace kyfoo::ast;
+#define X(a,b) if ( auto e = expr.as<b>() ) return myOperator.expr##a(*e);
+        EXPRESSION_KINDS(X)
+#undef X
+
+        throw std::runtime_error("invalid expression kind");
+    }
+
+    typename operator_t::result_t operator()(kyfoo::ast::Declaration const& decl)
+    {
+        using namespace kyfoo::ast;
+#define X(a,b,c) if ( auto d = decl.as<c>() ) return myOperator.decl##a(*d);
+        DECLARATION_KINDS(X)
+#undef X
+
+        throw std::runtime_error("invalid declaration kind");
+    }
+
+private:
+    operator_t myOperator;
+};
+
+// Hand-written traversal over the nodes DeepApply visits
+template <typename Dispatcher>
+struct NodeCounter
+{
+    using result_t = std::size_t;
+    Dispatcher& dispatch;
+
+    NodeCounter(Dispatcher& dispatch)
+        : dispatch(dispatch)
+    {
+    }
+
+    result_t visit(kyfoo::ast::Expression const& expr)
+    {
+        return dispatch(expr);
+    }
+
+    result_t visit(kyfoo::ast::Declaration const& decl)
+    {
+        return dispatch(decl);
+    }
+
+    template <typename T>
+    result_t all(T const& nodes)
+    {
+        result_t ret = 0;
+        for ( auto const& n : nodes )
+            ret += visit(*n);
+
+        return ret;
+    }
+
+    result_t scope(kyfoo::ast::DeclarationScope const* defn)
+    {
+        return defn ? all(defn->childDeclarations()) : 0;
+    }
+
+    result_t exprPrimary(kyfoo::ast::PrimaryExpression const& p)
+    {
+        return 1 + all(p.constraints());
+    }
+
+    result_t exprTuple(kyfoo::ast::TupleExpression const& t)
+    {
+        return 1 + all(t.expressions()) + all(t.constraints());
+    }
+
+    result_t exprApply(kyfoo::ast::ApplyExpression const& a)
+    {
+        return 1 + all(a.expressions()) + all(a.constraints());
+    }
+
+    result_t exprSymbol(kyfoo::ast::SymbolExpression const& s)
+    {
+        return 1 + all(s.expressions()) + all(s.constraints());
+    }
+
+    result_t decl(kyfoo::ast::Declaration const& d)
+    {
+        return 1 + all(d.symbol().parameters());
+    }
+
+    result_t declDataSum(kyfoo::ast::DataSumDeclaration const& ds)
+    {
+        return decl(ds) + scope(ds.definition());
+    }
+
+    result_t declDataSumCtor(kyfoo::ast::DataSumDeclaration::Constructor const& dsCtor)
+    {
+        return decl(dsCtor) + all(dsCtor.fields());
+    }
+
+    result_t declDataProduct(kyfoo::ast::DataProductDeclaration const& dp)
+    {
+        return decl(dp) + scope(dp.definition());
+    }
+
+    result_t declSymbol(kyfoo::ast::SymbolDeclaration const& s)
+    {
+        return decl(s) + (s.expression() ? visit(*s.expression()) : 0);
+    }
+
+    result_t declProcedure(kyfoo::ast::ProcedureDeclaration const& proc)
+    {
+        auto ret = decl(proc) + all(proc.parameters());
+        if ( proc.returnType() )
+            ret += visit(*proc.returnType());
+
+        if ( auto defn = proc.definition() )
+            ret += scope(defn) + all(defn->expressions());
+
+        return ret;
+    }
+
+    result_t declVariable(kyfoo::ast::VariableDeclaration const& var)
+    {
+        auto ret = decl(var);
+        if ( var.constraint() )
+            ret += visit(*var.constraint());
+
+        if ( var.initialization() )
+            ret += visit(*var.initialization());
+
+        return ret;
+    }
+
+    result_t declImport(kyfoo::ast::ImportDeclaration const& imp)
+    {
+        return decl(imp);
+    }
+
+    result_t declSymbolVariable(kyfoo::ast::SymbolVariable const& sv)
+    {
+        return decl(sv);
+    }
+};
+
+template <typename Dispatcher>
+struct DeepNodeCounter : public kyfoo::ast::DeepVisitor<Dispatcher>
+{
+    std::size_t count = 0;
+
+    DeepNodeCounter(Dispatcher& dispatch)
+        : kyfoo::ast::DeepVisitor<Dispatcher>(dispatch)
+    {
     }
 
-    return EXIT_SUCCESS;
-}
+#define X(a,b) bool expr##a(kyfoo::ast::b const&) { ++count; return true; }
+    EXPRESSION_KINDS(X)
+#undef X
+
+#define X(a,b,c) bool decl##a(kyfoo::ast::c const&) { ++count; return true; }
+    DECLARATION_KINDS(X)
+#undef X
+};
 
-int runParserTest(fs::path const& filepath)
+// Times each dispatcher over every node of the parsed module
+int runVisitorBench(fs::path const& filepath, std::size_t rounds)
 {
     kyfoo::Diagnostics dgn;
     kyfoo::ast::ModuleSet moduleSet;
     auto main = moduleSet.create(filepath);
     try {
         main->parse(dgn);
-        kyfoo::ast::JsonOutput output(std::cout);
-        main->io(output);
     }
     catch (kyfoo::Diagnostics*) {
-        // Handled below
+        dgn.dumpErrors(std::cout);
+        return EXIT_FAILURE;
     }
     catch (std::exception const& e) {
         std::cout << filepath << ": ICE: " << e.what() << std::endl;
         return EXIT_FAILURE;
     }
 
-    dgn.dumpErrors(std::cout);
+    auto const decls = main->scope()->childDeclarations();
+    auto report = [rounds](char const* name, std::size_t nodes, kyfoo::StopWatch& sw) {
+        auto const time = sw.reset().count();
+        std::cout << std::left << std::setw(10) << name
+                  << "nodes: " << nodes
+                  << "; time: " << time
+                  << "; ns/node: " << time * 1e9 / (double(nodes) * rounds) << std::endl;
+    };
 
-    if ( dgn.errorCount() )
+    std::size_t chain = 0;
+    std::size_t shallow = 0;
+    std::size_t deep = 0;
+
+    kyfoo::StopWatch sw;
+    {
+        IfChainApply<NodeCounter> op;
+        for ( std::size_t r = 0; r != rounds; ++r )
+            for ( auto d : decls )
+                chain += op(*d);
+    }
+    report("if-chain", chain / rounds, sw);
+
+    {
+        kyfoo::ast::ShallowApply<NodeCounter> op;
+        for ( std::size_t r = 0; r != rounds; ++r )
+            for ( auto d : decls )
+                shallow += op(static_cast<kyfoo::ast::Declaration const&>(*d));
+    }
+    report("switch", shallow / rounds, sw);
+
+    {
+        kyfoo::ast::DeepApply<DeepNodeCounter> op;
+        for ( std::size_t r = 0; r != rounds; ++r )
+            for ( auto d : decls )
+                op(static_cast<kyfoo::ast::Declaration const&>(*d));
+
+        deep = op.op().count;
+    }
+    report("deep", deep / rounds, sw);
+
+    if ( chain != shallow || chain != deep ) {
+        std::cout << "node counts differ" << std::endl;
         return EXIT_FAILURE;
+    }
 
     return EXIT_SUCCESS;
 }
 
-int analyzeModule(kyfoo::ast::Module* m, bool treeDump)
+int analyzeModule(std::ostream& out, kyfoo::ast::Module* m, bool treeDump)
 {
     kyfoo::Diagnostics dgn;
     kyfoo::StopWatch sw;
@@ -99,8 +900,8 @@ int analyzeModule(kyfoo::ast::Module* m, bool treeDump)
         if ( treeDump ) {
             std::ofstream fout(m->name() + ".astdump.json");
             if ( fout ) {
-                kyfoo::ast::JsonOutput out(fout);
-                m->io(out);
+                kyfoo::ast::JsonOutput json(fout);
+                m->io(json);
             }
         }
     }
@@ -108,13 +909,13 @@ int analyzeModule(kyfoo::ast::Module* m, bool treeDump)
         // Handled below
     }
     catch (std::exception const& e) {
-        std::cout << m->path() << ": ICE: " << e.what() << std::endl;
+        out << m->path() << ": ICE: " << e.what() << std::endl;
         return EXIT_FAILURE;
     }
 
     auto semTime = sw.reset();
-    dgn.dumpErrors(std::cout);
-    std::cout << "semantics: " << m->name() << "; errors: " << dgn.errorCount() << "; time: " << semTime.count() << std::endl;
+    dgn.dumpErrors(out);
+    out << "semantics: " << m->name() << "; errors: " << dgn.errorCount() << "; time: " << semTime.count() << std::endl;
 
     if ( dgn.errorCount() )
         return EXIT_FAILURE;
@@ -122,10 +923,10 @@ int analyzeModule(kyfoo::ast::Module* m, bool treeDump)
     return EXIT_SUCCESS;
 }
 
-int codegenModule(kyfoo::ast::Module* m)
+int codegenModule(std::ostream& out, kyfoo::ast::Module* m)
 {
     if ( m->path().empty() ) {
-        std::cout << "ICE: " << m->name() << ": module is internal" << std::endl;
+        out << "ICE: " << m->name() << ": module is internal" << std::endl;
         return EXIT_FAILURE;
     }
 
@@ -140,13 +941,13 @@ int codegenModule(kyfoo::ast::Module* m)
         // Handled below
     }
     catch (std::exception const& e) {
-        std::cout << m->path() << ": ICE: " << e.what() << std::endl;
+        out << m->path() << ": ICE: " << e.what() << std::endl;
         return EXIT_FAILURE;
     }
 
     auto semTime = sw.reset();
-    dgn.dumpErrors(std::cout);
-    std::cout << "codegen: " << m->name() << "; errors: " << dgn.errorCount() << "; time: " << semTime.count() << std::endl;
+    dgn.dumpErrors(out);
+    out << "codegen: " << m->name() << "; errors: " << dgn.errorCount() << "; time: " << semTime.count() << std::endl;
 
     if ( dgn.errorCount() )
         return EXIT_FAILURE;
@@ -154,92 +955,424 @@ int codegenModule(kyfoo::ast::Module* m)
     return EXIT_SUCCESS;
 }
 
-enum Options
-{
-    None          = 0,
-    TreeDump      = 1 << 0,
-    SemanticsOnly = 1 << 1,
-};
-
-int compile(std::vector<fs::path> const& files, std::uint32_t options)
+// Runs semantics on a module parsed from text, returning its diagnostics
+std::string semanticsOutput(kyfoo::ast::ModuleSet& moduleSet, std::string const& name, std::string const& text)
 {
-    auto ret = EXIT_SUCCESS;
-    kyfoo::ast::ModuleSet moduleSet;
+    std::ostringstream out;
+    kyfoo::Diagnostics dgn;
+    auto m = moduleSet.create(name);
     try {
-        if ( !moduleSet.axioms() ) {
-            std::cout << "ICE: axioms module contains errors" << std::endl;
-            return EXIT_FAILURE;
-        }
+        m->parse(dgn, std::make_unique<kyfoo::lexer::SourceBuffer>(std::string(text)));
+        m->resolveImports(dgn);
+        m->semantics(dgn);
+    }
+    catch (kyfoo::Diagnostics*) {
+        // Handled below
     }
     catch (std::exception const& e) {
-        std::cout << "ICE: " << e.what() << std::endl;
-        return EXIT_FAILURE;
+        out << "ICE: " << e.what() << '\n';
     }
 
-    std::set<kyfoo::ast::Module*> visited;
-    std::queue<kyfoo::ast::Module*> queue;
+    dgn.dumpErrors(out);
+    return out.str();
+}
 
-    auto append = [&](kyfoo::ast::Module* m) {
-        if ( visited.find(m) == end(visited) )
-            queue.push(m);
-    };
+// Analyzes text after another module failed to instantiate the same axioms
+// template, which must look the instance up again as a fresh module set would
+bool sameRetry(std::string const& name, std::string const& text)
+{
+    kyfoo::ast::ModuleSet fresh;
+    auto const expected = semanticsOutput(fresh, name, text);
 
-    auto take = [&] {
-        auto ret = queue.front();
-        queue.pop();
-        visited.insert(ret);
-        return ret;
+    kyfoo::ast::ModuleSet moduleSet;
+    semanticsOutput(moduleSet, "failed", text);
+    auto const output = semanticsOutput(moduleSet, name, text);
+    if ( output != expected ) {
+        std::cout << name << ": retried instantiation differs from a fresh module set\n"
+                  << "expected:\n" << expected << "got:\n" << output;
+        return false;
+    }
+
+    return true;
+}
+
+// Instantiations that throw while resolving
+int runInstanceCheck()
+{
+    int ret = EXIT_SUCCESS;
+    if ( !sameRetry("array", "a = array<i32>\n") )
+        ret = EXIT_FAILURE;
+
+    return ret;
+}
+
+// Parses the roots and everything they import on a pool of threads. Each
+// module's imports are submitted as soon as they are resolved. Output is
+// printed afterwards, in the order a serial breadth-first parse would give.
+//
+// At most jobs threads parse at once: a worker may parse its module in
+// chunks on the threads left idle, keeping one for each queued module.
+int parseModules(kyfoo::ast::ModuleSet& moduleSet,
+                 std::vector<kyfoo::ast::Module*> const& roots,
+                 std::set<kyfoo::ast::Module*>& visited,
+                 unsigned jobs)
+{
+    struct Result
+    {
+        std::string output;
+        bool failed = false;
+        bool ice = false;
     };
 
-    // seed with modules created directly from input files
-    for ( auto const& f : files )
-        append(moduleSet.create(f));
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::queue<kyfoo::ast::Module*> queue;
+    std::map<kyfoo::ast::Module*, Result> results;
+    std::size_t busy = 0;
+    std::size_t borrowed = 0;
 
-    // parse and imports extraction
-    // Every module will be parsed before the semantics pass so that symbols
-    // may be resolved across module boundaries
+    // Requires mutex
+    auto submit = [&](kyfoo::ast::Module* m) {
+        if ( m != moduleSet.axioms() && visited.insert(m).second ) {
+            queue.push(m);
+            wake.notify_one();
+        }
+    };
 
-    // TODO: lazily parse when this consumes too much memory
-    std::chrono::duration<double> parseTime;
-    while ( !queue.empty() ) {
-        auto m = take();
+    auto parse = [&](kyfoo::ast::Module* m, Result& result, unsigned concurrency) {
+        if ( m->parsed() )
+            return;
 
+        std::ostringstream out;
         kyfoo::Diagnostics dgn;
         kyfoo::StopWatch sw;
         try {
-            if ( m->parsed() )
-                continue;
-
-            m->parse(dgn);
+            m->parse(dgn, concurrency);
             m->resolveImports(dgn);
-            for ( auto const& i : m->imports() ) {
-                if ( i != moduleSet.axioms() )
-                    append(i);
-            }
         }
         catch (kyfoo::Diagnostics*) {
             // Handled below
         }
         catch (std::exception const& e) {
-            std::cout << m->path() << ": ICE: " << e.what() << std::endl;
-            return EXIT_FAILURE;
+            out << m->path() << ": ICE: " << e.what() << std::endl;
+            result.output = out.str();
+            result.ice = true;
+            return;
         }
 
-        parseTime = sw.reset();
-        dgn.dumpErrors(std::cout);
-        std::cout << "parse: " << m->path() << "; errors: " << dgn.errorCount() << "; time: " << parseTime.count() << std::endl;
+        auto parseTime = sw.reset();
+        dgn.dumpErrors(out);
+        out << "parse: " << m->path() << "; errors: " << dgn.errorCount() << "; time: " << parseTime.count() << std::endl;
+        result.output = out.str();
+        result.failed = dgn.errorCount() != 0;
+    };
+
+    auto work = [&] {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            wake.wait(lock, [&] { return (!queue.empty() && busy + borrowed < jobs) || !busy; });
+            if ( queue.empty() )
+                return;
+
+            auto m = queue.front();
+            queue.pop();
+            auto& result = results[m];
+            ++busy;
+
+            auto const idle = jobs - busy - borrowed;
+            auto const extra = idle > queue.size() ? idle - queue.size() : 0;
+            borrowed += extra;
+
+            lock.unlock();
+            parse(m, result, static_cast<unsigned>(1 + extra));
+            lock.lock();
+
+            if ( !result.ice ) {
+                for ( auto i : m->imports() )
+                    submit(i);
+            }
+
+            borrowed -= extra;
+            --busy;
+            wake.notify_all();
+        }
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for ( auto m : roots )
+            submit(m);
+    }
+
+    std::vector<std::thread> workers(jobs - 1);
+    for ( auto& w : workers )
+        w = std::thread(work);
 
-        if ( dgn.errorCount() )
+    work();
+    for ( auto& w : workers )
+        w.join();
+
+    int ret = EXIT_SUCCESS;
+    std::set<kyfoo::ast::Module*> seen;
+    std::vector<kyfoo::ast::Module*> order;
+    for ( auto m : roots ) {
+        if ( seen.insert(m).second )
+            order.push_back(m);
+    }
+
+    for ( std::size_t i = 0; i != order.size(); ++i ) {
+        auto const& result = results[order[i]];
+        std::cout << result.output;
+        if ( result.ice )
+            return EXIT_FAILURE;
+
+        if ( result.failed )
             ret = EXIT_FAILURE;
+
+        for ( auto m : order[i]->imports() ) {
+            if ( m != moduleSet.axioms() && seen.insert(m).second )
+                order.push_back(m);
+        }
     }
 
-    if ( ret != EXIT_SUCCESS )
-        return ret;
+    return ret;
+}
 
-    // semantic pass
-    for ( auto const& v : visited )
-        queue.push(v);
-    visited.clear();
+enum Options
+{
+    None          = 0,
+    TreeDump      = 1 << 0,
+    SemanticsOnly = 1 << 1,
+};
+
+// Appends m after the modules it imports
+void orderByImports(kyfoo::ast::Module* m,
+                    std::set<kyfoo::ast::Module*> const& modules,
+                    std::set<kyfoo::ast::Module*>& seen,
+                    std::vector<kyfoo::ast::Module*>& order)
+{
+    if ( !modules.count(m) || !seen.insert(m).second )
+        return;
+
+    for ( auto i : m->imports() )
+        orderByImports(i, modules, seen, order);
+
+    order.push_back(m);
+}
+
+template <typename Dispatcher>
+struct FindSymbolVariable : public kyfoo::ast::DeepVisitor<Dispatcher>
+{
+    bool found = false;
+
+    FindSymbolVariable(Dispatcher& dispatch)
+        : kyfoo::ast::DeepVisitor<Dispatcher>(dispatch)
+    {
+    }
+
+    bool exprPrimary(kyfoo::ast::PrimaryExpression const& p)
+    {
+        if ( p.token().kind() == kyfoo::lexer::TokenKind::FreeVariable )
+            found = true;
+
+        return !found;
+    }
+};
+
+// Whether m declares templates, which other modules' semantics instantiate
+// into m's scopes
+bool declaresTemplates(kyfoo::ast::Module const& m)
+{
+    kyfoo::ast::DeepApply<FindSymbolVariable> op;
+    for ( auto d : m.scope()->childDeclarations() ) {
+        op(static_cast<kyfoo::ast::Declaration const&>(*d));
+        if ( op.op().found )
+            return true;
+    }
+
+    return false;
+}
+
+// Runs semantics (and codegen) on a pool of threads. Modules are ordered
+// imports first and each module's output is buffered, then printed in that
+// order up to the first failing module. A single job keeps the serial
+// driver's order instead: the set's, one module at a time.
+//
+// A module starts once the modules it imports have finished. It also waits
+// for every earlier module it shares a template-declaring import with: an
+// instance is added to the module declaring the template, and its errors
+// are reported by whichever module instantiates it first, so those modules
+// must run in serial order. Modules sharing only template-free imports run
+// concurrently, but those sharing a generic library, the common case, still
+// run one at a time. Axioms are exempt, as they instantiate without
+// diagnostics.
+int analyzeModules(std::set<kyfoo::ast::Module*> const& modules, std::uint32_t options, unsigned jobs)
+{
+    if ( jobs == 1 ) {
+        for ( auto m : modules ) {
+            auto ret = analyzeModule(std::cout, m, (options & TreeDump) != 0);
+            if ( ret != EXIT_SUCCESS )
+                return ret;
+
+            if ( options & SemanticsOnly )
+                continue;
+
+            if ( (ret = codegenModule(std::cout, m)) != EXIT_SUCCESS )
+                return ret;
+        }
+
+        return EXIT_SUCCESS;
+    }
+
+    std::vector<kyfoo::ast::Module*> order;
+    {
+        std::set<kyfoo::ast::Module*> seen;
+        for ( auto m : modules )
+            orderByImports(m, modules, seen, order);
+    }
+
+    std::vector<std::set<kyfoo::ast::Module*>> closure(order.size());
+    for ( std::size_t i = 0; i != order.size(); ++i ) {
+        std::vector<kyfoo::ast::Module*> pending(1, order[i]);
+        while ( !pending.empty() ) {
+            auto m = pending.back();
+            pending.pop_back();
+            for ( auto d : m->imports() ) {
+                if ( modules.count(d) && closure[i].insert(d).second )
+                    pending.push_back(d);
+            }
+        }
+    }
+
+    std::set<kyfoo::ast::Module*> generic;
+    for ( auto m : order ) {
+        if ( declaresTemplates(*m) )
+            generic.insert(m);
+    }
+
+    std::vector<std::vector<std::size_t>> blockers(order.size());
+    for ( std::size_t i = 0; i != order.size(); ++i ) {
+        for ( std::size_t j = 0; j != i; ++j ) {
+            auto const shared = std::any_of(begin(closure[j]), end(closure[j]), [&](kyfoo::ast::Module* m) {
+                return generic.count(m) && closure[i].count(m);
+            });
+            if ( shared || closure[i].count(order[j]) )
+                blockers[i].push_back(j);
+        }
+    }
+
+    struct Result
+    {
+        std::ostringstream output;
+        int ret = EXIT_SUCCESS;
+        bool started = false;
+        bool done = false;
+    };
+
+    std::mutex mutex;
+    std::mutex codegenMutex;
+    std::condition_variable wake;
+    std::vector<Result> results(order.size());
+    auto failed = order.size();
+    std::size_t busy = 0;
+
+    auto run = [&](std::size_t i) {
+        auto& result = results[i];
+        result.ret = analyzeModule(result.output, order[i], (options & TreeDump) != 0);
+        if ( result.ret != EXIT_SUCCESS || (options & SemanticsOnly) )
+            return;
+
+        // Generated types are recorded on declarations shared through imports
+        std::lock_guard<std::mutex> lock(codegenMutex);
+        result.ret = codegenModule(result.output, order[i]);
+    };
+
+    // Requires mutex
+    auto next = [&] {
+        for ( std::size_t i = 0; i != failed; ++i ) {
+            if ( results[i].started )
+                continue;
+
+            auto const ready = std::all_of(begin(blockers[i]), end(blockers[i]),
+                                           [&](std::size_t j) { return results[j].done; });
+            if ( ready )
+                return i;
+        }
+
+        return order.size();
+    };
+
+    auto work = [&] {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            auto i = order.size();
+            wake.wait(lock, [&] { i = next(); return i != order.size() || !busy; });
+            if ( i == order.size() )
+                return;
+
+            results[i].started = true;
+            ++busy;
+
+            lock.unlock();
+            run(i);
+            lock.lock();
+
+            results[i].done = true;
+            if ( results[i].ret != EXIT_SUCCESS && i < failed )
+                failed = i;
+
+            --busy;
+            wake.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers(jobs - 1);
+    for ( auto& w : workers )
+        w = std::thread(work);
+
+    work();
+    for ( auto& w : workers )
+        w.join();
+
+    for ( std::size_t i = 0; i != order.size() && i <= failed; ++i )
+        std::cout << results[i].output.str();
+
+    if ( failed != order.size() )
+        return results[failed].ret;
+
+    return EXIT_SUCCESS;
+}
+
+int compile(std::vector<fs::path> const& files, std::uint32_t options, unsigned jobs)
+{
+    auto ret = EXIT_SUCCESS;
+
+    // Never destroyed: destruction visits every node, while exiting releases
+    // the set's arenas and heap at once
+    static auto& moduleSet = *new kyfoo::ast::ModuleSet;
+    try {
+        if ( !moduleSet.axioms() ) {
+            std::cout << "ICE: axioms module contains errors" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    catch (std::exception const& e) {
+        std::cout << "ICE: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<kyfoo::ast::Module*> roots;
+    for ( auto const& f : files )
+        roots.push_back(moduleSet.create(f));
+
+    // parse and imports extraction
+    // Every module will be parsed before the semantics pass so that symbols
+    // may be resolved across module boundaries
+
+    // TODO: lazily parse when this consumes too much memory
+    std::set<kyfoo::ast::Module*> visited;
+    if ( (ret = parseModules(moduleSet, roots, visited, jobs)) != EXIT_SUCCESS )
+        return ret;
 
     {
         // todo: better way to codegen axioms
@@ -260,19 +1393,8 @@ int compile(std::vector<fs::path> const& files, std::uint32_t options)
         }
     }
 
-    while ( !queue.empty() ) {
-        auto m = take();
-        if ( (ret = analyzeModule(m, options & TreeDump)) != EXIT_SUCCESS )
-            return ret;
-
-        if ( options & SemanticsOnly )
-            continue;
-
-        if ( (ret = codegenModule(m)) != EXIT_SUCCESS )
-            return ret;
-    }
-
-    return ret;
+    // semantic pass
+    return analyzeModules(visited, options, jobs);
 }
 
 void printHelp(fs::path const& arg0)
@@ -284,23 +1406,36 @@ void printHelp(fs::path const& arg0)
         "\n"
         "COMMAND:\n"
         "  scan, lexer, lex    Prints the lexer output of the module\n"
+        "  lexcheck            Compares the lexer output of each scanner implementation\n"
         "  parse, grammar      Prints the parse tree as JSON\n"
-        "  semantics, sem      Checks the module for semantic errors"
-        "  semdump             Checks semantics and prints tree"
-        "  c, compile          Compiles the module"
+        "    --stats           Prints match counts per grammar production instead\n"
+        "    --stateless       Parses with the stateless grammar\n"
+        "  parsecheck          Compares the parse trees of both grammars\n"
+        "    --generate N      Also compares N generated modules\n"
+        "  reparsecheck        Compares incremental reparses against full parses\n"
+        "    --edits N         Applies N random edits to each file (default 100)\n"
+        "  instcheck           Retries template instantiations that failed in another module\n"
+        "  visitbench          Times AST visitor dispatch over the parsed module\n"
+        "    --rounds N        Traverses the module N times (default 100)\n"
+        "  semantics, sem      Checks the module for semantic errors\n"
+        "    --stats           Also prints overload candidates per call site\n"
+        "    --jobs N          Uses N threads; 1 analyzes modules in the serial order\n"
+        "  semdump             Checks semantics and prints tree\n"
+        "  c, compile          Compiles the module\n"
+        "    --jobs N          Uses N threads"
         << std::endl;
 }
 
 int main(int argc, char* argv[])
 {
     try {
-        if ( argc < 3 ) {
+        if ( argc < 2 || (argc < 3 && std::string(argv[1]) != "instcheck") ) {
             printHelp(argv[0]);
             return EXIT_FAILURE;
         }
 
         std::string command = argv[1];
-        std::string file = argv[2];
+        std::string file = argc > 2 ? argv[2] : "";
 
         if ( command == "scan" || command == "lex" || command == "lexer" ) {
             if ( argc != 3 ) {
@@ -310,31 +1445,132 @@ int main(int argc, char* argv[])
 
             return runScannerDump(file);
         }
+        else if ( command == "lexcheck" ) {
+            std::vector<fs::path> files;
+            for ( int i = 2; i != argc; ++i )
+                files.push_back(argv[i]);
+
+            return runScannerCheck(files);
+        }
         else if ( command == "parse" || command == "grammar" ) {
-            if ( argc != 3 ) {
+            bool stats = false;
+            auto grammar = kyfoo::parser::GrammarKind::Stateful;
+            int i = 2;
+            for ( ; i < argc - 1; ++i ) {
+                std::string const option = argv[i];
+                if ( option == "--stats" )
+                    stats = true;
+                else if ( option == "--stateless" )
+                    grammar = kyfoo::parser::GrammarKind::Stateless;
+                else
+                    break;
+            }
+
+            if ( i != argc - 1 ) {
+                printHelp(argv[0]);
+                return EXIT_FAILURE;
+            }
+
+            return runParserTest(argv[i], stats, grammar);
+        }
+        else if ( command == "parsecheck" ) {
+            std::size_t count = 0;
+            int i = 2;
+            if ( file == "--generate" && argc > 3 ) {
+                count = std::stoul(argv[3]);
+                i = 4;
+            }
+
+            std::vector<fs::path> files;
+            for ( ; i != argc; ++i )
+                files.push_back(argv[i]);
+
+            return runParserCheck(files, count);
+        }
+        else if ( command == "reparsecheck" ) {
+            std::size_t count = 100;
+            int i = 2;
+            if ( file == "--edits" && argc > 3 ) {
+                count = std::stoul(argv[3]);
+                i = 4;
+            }
+
+            std::vector<fs::path> files;
+            for ( ; i != argc; ++i )
+                files.push_back(argv[i]);
+
+            return runReparseCheck(files, count);
+        }
+        else if ( command == "instcheck" ) {
+            if ( argc != 2 ) {
+                printHelp(argv[0]);
+                return EXIT_FAILURE;
+            }
+
+            return runInstanceCheck();
+        }
+        else if ( command == "visitbench" ) {
+            std::size_t rounds = 100;
+            int i = 2;
+            if ( file == "--rounds" && argc > 3 ) {
+                rounds = std::stoul(argv[3]);
+                i = 4;
+            }
+
+            if ( i != argc - 1 || !rounds ) {
                 printHelp(argv[0]);
                 return EXIT_FAILURE;
             }
 
-            return runParserTest(file);
+            return runVisitorBench(argv[i], rounds);
         }
         else if ( command == "semantics" || command == "sem" || command == "semdump" ) {
+            bool stats = false;
+            auto jobs = std::max(1u, std::thread::hardware_concurrency());
+            int i = 2;
+            for ( ; i < argc - 1; ++i ) {
+                std::string const option = argv[i];
+                if ( option == "--stats" )
+                    stats = true;
+                else if ( option == "--jobs" && i < argc - 2 && std::stoul(argv[i + 1]) )
+                    jobs = std::stoul(argv[++i]);
+                else
+                    break;
+            }
+
+            if ( stats && !kyfoo::ast::overloadStatsEnabled() ) {
+                kyfoo::ast::printOverloadStats(std::cout);
+                return EXIT_FAILURE;
+            }
+
             std::vector<fs::path> files;
-            for ( int i = 2; i != argc; ++i )
+            for ( ; i != argc; ++i )
                 files.push_back(argv[i]);
 
             std::uint32_t options = SemanticsOnly;
             if ( command == "semdump" )
                 options |= TreeDump;
 
-            return compile(files, options);
+            kyfoo::ast::resetOverloadStats();
+            auto const ret = compile(files, options, jobs);
+            if ( stats )
+                kyfoo::ast::printOverloadStats(std::cout);
+
+            return ret;
         }
         else if ( command == "compile" || command == "c" ) {
+            auto jobs = std::max(1u, std::thread::hardware_concurrency());
+            int i = 2;
+            if ( file == "--jobs" && argc > 4 && std::stoul(argv[3]) ) {
+                jobs = std::stoul(argv[3]);
+                i = 4;
+            }
+
             std::vector<fs::path> files;
-            for ( int i = 2; i != argc; ++i )
+            for ( ; i != argc; ++i )
                 files.push_back(argv[i]);
 
-            return compile(files, None);
+            return compile(files, None, jobs);
         }
 
         std::cout << "Unknown option: " << command << std::endl;
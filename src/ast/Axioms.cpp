@@ -20,6 +20,8 @@ staticSize<\T>(p : pointer T) : size_t => wordSize
 
 #include <kyfoo/ast/Axioms.hpp>
 
+#include <kyfoo/lexer/SourceBuffer.hpp>
+
 #include <kyfoo/ast/Expressions.hpp>
 #include <kyfoo/ast/Declarations.hpp>
 #include <kyfoo/ast/Module.hpp>
@@ -33,7 +35,7 @@ namespace kyfoo {
 
 AxiomsModule::AxiomsModule(ModuleSet* moduleSet, std::string const& name)
     : Module(moduleSet, name)
-    , myEmptyType(std::make_unique<DataSumDeclaration>(Symbol("")))
+    , myEmptyType(std::make_unique<DataSumDeclaration>(Symbol(lexer::Token())))
 {
 }
 
@@ -66,10 +68,9 @@ ProcedureDeclaration const* AxiomsModule::addInstruction() const
 
 bool AxiomsModule::init()
 {
-    std::stringstream s(source);
     Diagnostics dgn;
     try {
-        parse(dgn, s);
+        parse(dgn, std::make_unique<lexer::SourceBuffer>(std::string_view(source)));
         if ( dgn.errorCount() )
             return false;
 
@@ -3,10 +3,48 @@
 #include <kyfoo/Diagnostics.hpp>
 #include <kyfoo/ast/Module.hpp>
 #include <kyfoo/ast/Scopes.hpp>
+#include <kyfoo/ast/Semantics.hpp>
 
 namespace kyfoo {
     namespace ast {
 
+namespace {
+    /**
+     * Walks the scope chain and then the imports, trying find on each visible
+     * set until one matches
+     *
+     * Scopes without a set named by symbol are only checked for symbol
+     * variables, when variables is set.
+     */
+    template <typename Find>
+    LookupHit match(LookupHit hit,
+                    DeclarationScope* scope,
+                    DeclarationScope::visible_sets_t const& visible,
+                    SymbolReference const& symbol,
+                    bool variables,
+                    Find&& find)
+    {
+        auto v = begin(*visible);
+        for ( ; scope; scope = scope->parent() ) {
+            if ( v != end(*visible) && v->scope == scope ) {
+                if ( hit.append(find(*v++)) )
+                    return hit;
+            }
+
+            if ( variables && symbol.parameters().empty() )
+                if ( auto decl = scope->declaration() )
+                    if ( auto s = decl->symbol().findVariable(symbol.id()) )
+                        return std::move(hit.lookup(s));
+        }
+
+        for ( ; v != end(*visible); ++v )
+            if ( hit.append(find(*v)) )
+                return hit;
+
+        return hit;
+    }
+} // namespace
+
 //
 // ScopeResolver
 
@@ -28,21 +66,10 @@ LookupHit ScopeResolver::matchEquivalent(SymbolReference const& symbol) const
     if ( hit )
         return hit;
 
-    for ( auto scope = myScope; scope; scope = scope->parent() ) {
-        if ( hit.append(scope->findEquivalent(symbol)) )
-            return hit;
-
-        if ( symbol.parameters().empty() )
-            if ( auto decl = scope->declaration() )
-                if ( auto s = decl->symbol().findVariable(symbol.name()) )
-                    return std::move(hit.lookup(s));
-    }
-
-    for ( auto m : module()->imports() )
-        if ( hit.append(m->scope()->findEquivalent(symbol)) )
-            return hit;
-
-    return hit;
+    return match(std::move(hit), myScope, myScope->visibleSymbols(symbol.id()), symbol, true,
+                 [&symbol](DeclarationScope::VisibleSet const& v) {
+                     return v.scope->findEquivalent(v.set, symbol);
+                 });
 }
 
 LookupHit ScopeResolver::matchValue(Diagnostics& dgn, SymbolReference const& symbol) const
@@ -51,35 +78,18 @@ LookupHit ScopeResolver::matchValue(Diagnostics& dgn, SymbolReference const& sym
     if ( hit )
         return hit;
 
-    for ( auto scope = myScope; scope; scope = scope->parent() ) {
-        if ( hit.append(scope->findValue(dgn, symbol)) )
-            return hit;
-
-        if ( symbol.parameters().empty() )
-            if ( auto decl = scope->declaration() )
-                if ( auto s = decl->symbol().findVariable(symbol.name()) )
-                    return std::move(hit.lookup(s));
-    }
-
-    for ( auto m : module()->imports() )
-        if ( hit.append(m->scope()->findValue(dgn, symbol)) )
-            return hit;
-
-    return hit;
+    return match(std::move(hit), myScope, myScope->visibleSymbols(symbol.id()), symbol, true,
+                 [&dgn, &symbol](DeclarationScope::VisibleSet const& v) {
+                     return v.scope->findValue(dgn, v.set, symbol);
+                 });
 }
 
 LookupHit ScopeResolver::matchProcedure(Diagnostics& dgn, SymbolReference const& procOverload) const
 {
-    LookupHit hit;
-    for ( auto scope = myScope; scope; scope = scope->parent() )
-        if ( hit.append(scope->findProcedureOverload(dgn, procOverload)) )
-            return hit;
-    
-    for ( auto m : module()->imports() )
-        if ( hit.append(m->scope()->findProcedureOverload(dgn, procOverload)) )
-            return hit;
-
-    return hit;
+    return match(LookupHit(), myScope, myScope->visibleProcedures(procOverload.id()), procOverload, false,
+                 [&dgn, &procOverload](DeclarationScope::VisibleSet const& v) {
+                     return v.scope->findProcedureOverload(dgn, v.set, procOverload);
+                 });
 }
 
 void ScopeResolver::addSupplementarySymbol(Symbol const& sym)
@@ -92,7 +102,7 @@ LookupHit ScopeResolver::matchSupplementary(SymbolReference const& symbol) const
     LookupHit hit;
     if ( symbol.parameters().empty() )
         for ( auto& s : mySupplementarySymbols )
-            if ( auto symVar = s->findVariable(symbol.name()) )
+            if ( auto symVar = s->findVariable(symbol.id()) )
                 return std::move(hit.lookup(symVar));
 
     return hit;
@@ -120,7 +130,7 @@ LookupHit SymbolVariableCreatorFailoverResolver::matchEquivalent(SymbolReference
         return hit;
 
     if ( symbol.parameters().empty() )
-        return LookupHit(mySymbol->createVariable(symbol.name()));
+        return LookupHit(mySymbol->createVariable(symbol.identifier()));
 
     return LookupHit();
 }
@@ -131,7 +141,7 @@ LookupHit SymbolVariableCreatorFailoverResolver::matchValue(Diagnostics& dgn, Sy
         return hit;
 
     if ( symbol.parameters().empty() )
-        return LookupHit(mySymbol->createVariable(symbol.name()));
+        return LookupHit(mySymbol->createVariable(symbol.identifier()));
 
     return LookupHit();
 }
@@ -224,5 +234,25 @@ void Context::resolveExpressions(std::vector<std::unique_ptr<Expression>>& expre
     }
 }
 
+void Context::resolveType(std::unique_ptr<Expression>& type)
+{
+    resolveExpression(type);
+    canonicalize(*type);
+}
+
+void Context::resolveTypes(std::vector<std::unique_ptr<Expression>>& types)
+{
+    resolveExpressions(types);
+    for ( auto& t : types )
+        canonicalize(*t);
+}
+
+void Context::canonicalize(Expression& expression)
+{
+    // Resolving again may have changed what the expression refers to
+    expression.myCanonical = nullptr;
+    expression.myCanonical = module()->moduleSet()->types().canonical(expression);
+}
+
     } // namespace ast
 } // namespace kyfoo
@@ -434,7 +434,7 @@ void VariableDeclaration::resolveSymbols(Diagnostics& dgn)
     Context ctx(dgn, resolver);
 
     if ( myConstraint ) {
-        ctx.resolveExpression(myConstraint);
+        ctx.resolveType(myConstraint);
 
         auto s = myConstraint->as<SymbolExpression>();
         if ( !s ) {
@@ -472,6 +472,16 @@ Expression const* VariableDeclaration::constraint() const
     return myConstraint.get();
 }
 
+Expression* VariableDeclaration::initialization()
+{
+    return myInitialization.get();
+}
+
+Expression const* VariableDeclaration::initialization() const
+{
+    return myInitialization.get();
+}
+
 //
 // ProcedureParameter
 
@@ -520,7 +530,7 @@ void ProcedureParameter::resolveSymbols(Diagnostics& dgn)
 
     Context ctx(dgn, resolver);
     if ( constraint() )
-        ctx.resolveExpression(myConstraint);
+        ctx.resolveType(myConstraint);
 }
 
 void ProcedureParameter::setParent(ProcedureDeclaration* procDecl)
@@ -639,7 +649,7 @@ ProcedureScope const* ProcedureDeclaration::definition() const
 void ProcedureDeclaration::define(std::unique_ptr<ProcedureScope> definition)
 {
     if ( myDefinition )
-        throw std::runtime_error("procedure " + mySymbol->name() + " is already defined");
+        throw std::runtime_error("procedure " + std::string(mySymbol->name()) + " is already defined");
 
     myDefinition = std::move(definition);
     myDefinition->setDeclaration(this);
@@ -722,17 +732,15 @@ void ImportDeclaration::resolveSymbols(Diagnostics&)
 //
 // SymbolVariable
 
-SymbolVariable::SymbolVariable(Symbol& parent, std::string const& name)
-    : Declaration(DeclKind::SymbolVariable, Symbol(lexer::Token(lexer::TokenKind::Identifier, parent.identifier().line(), parent.identifier().column(), name)), nullptr)
+SymbolVariable::SymbolVariable(Symbol& parent, lexer::Token const& identifier)
+    : Declaration(DeclKind::SymbolVariable, Symbol(identifier), nullptr)
     , myParent(&parent)
-    , myName(name)
 {
 }
 
 SymbolVariable::SymbolVariable(SymbolVariable const& rhs)
     : Declaration(rhs)
     , myParent(rhs.myParent)
-    , myName(rhs.myName)
     , myBoundExpression(rhs.myBoundExpression)
 {
 }
@@ -750,14 +758,13 @@ void SymbolVariable::swap(SymbolVariable& rhs)
     Declaration::swap(rhs);
     using std::swap;
     swap(myParent, rhs.myParent);
-    swap(myName, rhs.myName);
     swap(myBoundExpression, rhs.myBoundExpression);
 }
 
 void SymbolVariable::io(IStream& stream) const
 {
     Declaration::io(stream);
-    stream.next("name", myName);
+    stream.next("name", name());
 }
 
 IMPL_CLONE_BEGIN(SymbolVariable, Declaration, Declaration)
@@ -785,9 +792,9 @@ Expression const* SymbolVariable::boundExpression() const
     return myBoundExpression;
 }
 
-std::string const& SymbolVariable::name() const
+std::string_view SymbolVariable::name() const
 {
-    return myName;
+    return symbol().name();
 }
 
 Symbol const& SymbolVariable::parent() const
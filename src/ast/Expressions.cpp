@@ -8,6 +8,7 @@
 #include <kyfoo/ast/Axioms.hpp>
 #include <kyfoo/ast/Context.hpp>
 #include <kyfoo/ast/Declarations.hpp>
+#include <kyfoo/ast/OverloadStats.hpp>
 #include <kyfoo/ast/Scopes.hpp>
 #include <kyfoo/ast/Semantics.hpp>
 
@@ -43,6 +44,7 @@ void Expression::swap(Expression& rhs)
     swap(myKind, rhs.myKind);
     swap(myConstraints, rhs.myConstraints);
     swap(myDeclaration, rhs.myDeclaration);
+    swap(myCanonical, rhs.myCanonical);
 }
 
 void Expression::cloneChildren(Expression& c, clone_map_t& map) const
@@ -70,6 +72,11 @@ Declaration const* Expression::declaration() const
     return myDeclaration;
 }
 
+Expression const* Expression::canonical() const
+{
+    return myCanonical;
+}
+
 Slice<Expression*> Expression::constraints()
 {
     return myConstraints;
@@ -411,10 +418,11 @@ void ApplyExpression::resolveSymbols(Context& ctx)
     if ( !myExpressions.empty() )
         args = slice(myExpressions, 1);
 
-    SymbolReference sym(subject->token().lexeme(), args);
+    SymbolReference sym(subject->token(), args);
 
     // Look for hit on symbol
     auto symHit = ctx.matchValue(sym);
+    KYFOO_OVERLOAD_PROBE(ctx.module(), subject->token(), symHit);
     if ( symHit ) {
         // Transmute apply-expression into symbol-expression
         auto id = subject->token();
@@ -426,6 +434,7 @@ void ApplyExpression::resolveSymbols(Context& ctx)
 
     // Search procedure overloads by arguments
     auto procHit = ctx.matchProcedure(sym);
+    KYFOO_OVERLOAD_PROBE(ctx.module(), subject->token(), procHit);
     auto procDecl = procHit.as<ProcedureDeclaration>();
     if ( !procDecl ) {
         auto& err = ctx.error(*this) << "does not match any symbol declarations or procedure overloads";
@@ -566,8 +575,9 @@ void SymbolExpression::resolveSymbols(Context& ctx)
             return;
     }
 
-    SymbolReference sym(myIdentifier.lexeme(), myExpressions);
+    SymbolReference sym(myIdentifier, myExpressions);
     auto hit = ctx.matchValue(sym);
+    KYFOO_OVERLOAD_PROBE(ctx.module(), myIdentifier, hit);
     if ( !hit ) {
         ctx.error(*this) << "undeclared symbol identifier";
         return;
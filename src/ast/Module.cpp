@@ -1,13 +1,20 @@
 #include <kyfoo/ast/Module.hpp>
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <functional>
+#include <thread>
 
-#include <fstream>
 #include <filesystem>
 
+#include <kyfoo/Arena.hpp>
 #include <kyfoo/Diagnostics.hpp>
 
+#include <kyfoo/lexer/CharScan.hpp>
+#include <kyfoo/lexer/InternTable.hpp>
 #include <kyfoo/lexer/Scanner.hpp>
+#include <kyfoo/lexer/SourceBuffer.hpp>
 #include <kyfoo/lexer/Token.hpp>
 
 #include <kyfoo/parser/Parse.hpp>
@@ -15,6 +22,7 @@
 #include <kyfoo/ast/Axioms.hpp>
 #include <kyfoo/ast/Declarations.hpp>
 #include <kyfoo/ast/Scopes.hpp>
+#include <kyfoo/ast/Semantics.hpp>
 
 namespace fs = std::experimental::filesystem;
 
@@ -25,8 +33,11 @@ namespace kyfoo {
 // ModuleSet
 
 ModuleSet::ModuleSet()
-    : myAxioms(new AxiomsModule(this, "axioms"))
+    : myInternTable(std::make_unique<lexer::InternTable>())
+    , myTypes(std::make_unique<TypeTable>())
 {
+    // axioms() must read null while the axioms module itself is constructed
+    myAxioms.reset(new AxiomsModule(this, "axioms"));
     if ( !myAxioms->init() )
         myAxioms.reset();
 }
@@ -35,7 +46,8 @@ ModuleSet::~ModuleSet() = default;
 
 Module* ModuleSet::create(std::string const& name)
 {
-    auto m = find(name);
+    std::lock_guard<std::mutex> lock(myMutex);
+    auto m = lookup(name);
     if ( m )
         return m;
 
@@ -50,7 +62,10 @@ Module* ModuleSet::create(std::string const& name)
 
 Module* ModuleSet::create(fs::path const& path)
 {
-    auto m = find(path);
+    auto normalPath = canonical(path).make_preferred();
+
+    std::lock_guard<std::mutex> lock(myMutex);
+    auto m = lookup(normalPath);
     if ( m )
         return m;
 
@@ -65,7 +80,8 @@ Module* ModuleSet::create(fs::path const& path)
 
 Module* ModuleSet::createImplied(std::string const& name)
 {
-    auto m = find(name);
+    std::lock_guard<std::mutex> lock(myMutex);
+    auto m = lookup(name);
     if ( m )
         return m;
 
@@ -75,6 +91,20 @@ Module* ModuleSet::createImplied(std::string const& name)
 }
 
 Module* ModuleSet::find(std::string const& name)
+{
+    std::lock_guard<std::mutex> lock(myMutex);
+    return lookup(name);
+}
+
+Module* ModuleSet::find(std::experimental::filesystem::path const& path)
+{
+    auto normalPath = canonical(path).make_preferred();
+
+    std::lock_guard<std::mutex> lock(myMutex);
+    return lookup(normalPath);
+}
+
+Module* ModuleSet::lookup(std::string const& name)
 {
     for ( auto& m : myModules )
         if ( m->name() == name )
@@ -83,9 +113,8 @@ Module* ModuleSet::find(std::string const& name)
     return nullptr;
 }
 
-Module* ModuleSet::find(std::experimental::filesystem::path const& path)
+Module* ModuleSet::lookup(std::experimental::filesystem::path const& normalPath)
 {
-    auto normalPath = canonical(path).make_preferred();
     for ( auto& m : myModules )
         if ( m->path() == normalPath )
             return m.get();
@@ -103,6 +132,38 @@ AxiomsModule const* ModuleSet::axioms() const
     return myAxioms.get();
 }
 
+lexer::InternTable& ModuleSet::internTable()
+{
+    return *myInternTable;
+}
+
+lexer::InternTable const& ModuleSet::internTable() const
+{
+    return *myInternTable;
+}
+
+parser::GrammarKind ModuleSet::grammar() const
+{
+    return myGrammar;
+}
+
+void ModuleSet::setGrammar(parser::GrammarKind grammar)
+{
+    myGrammar = grammar;
+}
+
+Arena* ModuleSet::createArena()
+{
+    std::lock_guard<std::mutex> lock(myMutex);
+    myArenas.emplace_back(std::make_unique<Arena>());
+    return myArenas.back().get();
+}
+
+TypeTable& ModuleSet::types() const
+{
+    return *myTypes;
+}
+
 //
 // Module
 
@@ -127,6 +188,29 @@ Module::Module(ModuleSet* moduleSet,
 
 Module::~Module() = default;
 
+Arena& Module::arena()
+{
+    if ( !myArena )
+        myArena = myModuleSet->createArena();
+
+    return *myArena;
+}
+
+Arena& Module::createParseArena()
+{
+    myParseArenas.emplace_back(std::make_unique<Arena>());
+    return *myParseArenas.back();
+}
+
+std::size_t Module::parseArenaSize() const
+{
+    std::size_t ret = 0;
+    for ( auto const& a : myParseArenas )
+        ret += a->capacity();
+
+    return ret;
+}
+
 void Module::io(IStream& stream) const
 {
     stream.openGroup("module");
@@ -145,27 +229,244 @@ fs::path const& Module::path() const
     return myPath;
 }
 
-void Module::parse(Diagnostics& dgn)
+void Module::parse(Diagnostics& dgn, unsigned concurrency)
 {
-    std::ifstream fin(path());
-    if ( !fin ) {
+    auto source = lexer::SourceBuffer::fromFile(path());
+    if ( !source ) {
         dgn.error(this) << "failed to open source file";
         dgn.die();
     }
 
-    parse(dgn, fin);
+    parse(dgn, std::move(source), concurrency);
+}
+
+void Module::parse(Diagnostics& dgn, std::unique_ptr<lexer::SourceBuffer> source, unsigned concurrency)
+{
+    // Nothing outside the scope refers to parsed nodes before semantics
+    myScope.reset();
+    myParseArenas.clear();
+    NodeArenaScope arenaScope(createParseArena());
+
+    // Tokens refer into the source buffer, so it lives as long as the module
+    mySource = std::move(source);
+    myScope = std::make_unique<ast::DeclarationScope>(this);
+    myRetiredSources.clear();
+    mySpans.clear();
+
+    if ( concurrency > 1 && parseChunks(concurrency) ) {
+        myParsedSize = parseArenaSize();
+        return;
+    }
+
+    lexer::Scanner scanner(*mySource, myModuleSet->internTable(), lexer::ScanMode::Tokenized);
+    parseDeclarations(dgn, scanner, *myScope);
+    myParsedSize = parseArenaSize();
+
+    // Without spans, reparse falls back to parsing everything
+    if ( !spanDeclarations(scanner.tokens(), 0, static_cast<lexer::source_offset_t>(mySource->size()),
+                           mySource->id(), myScope->childDeclarations().size(), mySpans) )
+        mySpans.clear();
+}
+
+void Module::reparse(Diagnostics& dgn,
+                     lexer::source_offset_t first,
+                     lexer::source_offset_t last,
+                     std::string_view text)
+{
+    if ( !mySource || first > last || last > mySource->size() )
+        throw std::out_of_range("edit is outside of the module source");
+
+    auto const old = mySource->text();
+    std::string edited;
+    edited.reserve(old.size() - (last - first) + text.size());
+    edited.append(old.substr(0, first)).append(text).append(old.substr(last));
+    auto source = std::make_unique<lexer::SourceBuffer>(std::move(edited));
+
+    if ( mySpans.empty() || parseArenaSize() > 2 * myParsedSize )
+        return parse(dgn, std::move(source));
+
+    NodeArenaScope arenaScope(*myParseArenas.back());
+    auto spanAt = [this](lexer::source_offset_t offset) {
+        auto s = upper_bound(begin(mySpans), end(mySpans), offset,
+                             [](lexer::source_offset_t o, SourceSpan const& rhs) { return o < rhs.first; });
+        return static_cast<std::size_t>(s - begin(mySpans)) - 1;
+    };
+
+    // Include the span before an edit at its start, which may now continue it
+    auto const a = spanAt(first ? first - 1 : 0);
+    auto const b = spanAt(last);
+    auto const delta = static_cast<std::ptrdiff_t>(text.size()) - static_cast<std::ptrdiff_t>(last - first);
+    auto const regionFirst = mySpans[a].first;
+    auto const regionLast = static_cast<lexer::source_offset_t>(mySpans[b].last + delta);
+
+    // Lines at indent zero have an empty indentation stack, so scanning
+    // resumes there from scratch. Past the region the text is unchanged.
+    lexer::Scanner scanner(*source, myModuleSet->internTable(), lexer::ScanMode::Tokenized,
+                           regionFirst, regionLast);
+
+    // A string left open by the edit may run on past the region
+    for ( auto const& tok : scanner.tokens() ) {
+        if ( tok.kind() == lexer::TokenKind::Undefined || tok.kind() == lexer::TokenKind::IndentError )
+            return parse(dgn, std::move(source));
+    }
+
+    // Errors are left to the full parse, which reports them against the
+    // edited text as a whole
+    auto const tail = myScope->childDeclarations().size();
+    Diagnostics regionDgn;
+    auto failed = false;
+    try {
+        parseDeclarations(regionDgn, scanner, *myScope);
+    }
+    catch (...) {
+        failed = true;
+    }
+
+    auto const count = myScope->childDeclarations().size();
+    std::vector<SourceSpan> spans;
+    if ( failed
+      || regionDgn.errorCount()
+      || !spanDeclarations(scanner.tokens(), regionFirst, regionLast, source->id(), count - tail, spans) )
+    {
+        myScope->replaceDeclarations(tail, count, count);
+        return parse(dgn, std::move(source));
+    }
+
+    // Each span holds exactly one declaration
+    myScope->replaceDeclarations(a, b + 1, tail);
+
+    for ( auto i = b + 1; i != mySpans.size(); ++i ) {
+        mySpans[i].first = static_cast<lexer::source_offset_t>(mySpans[i].first + delta);
+        mySpans[i].last = static_cast<lexer::source_offset_t>(mySpans[i].last + delta);
+    }
+
+    mySpans.erase(begin(mySpans) + a, begin(mySpans) + b + 1);
+    mySpans.insert(begin(mySpans) + a, begin(spans), end(spans));
+
+    myRetiredSources.push_back(std::move(mySource));
+    mySource = std::move(source);
+    forwardRetiredSources();
 }
 
-void Module::parse(Diagnostics& dgn, std::istream& stream)
+// Parses the source in chunks split at lines starting at indent zero, each
+// on a worker into a scope of its own, then merges them in source order.
+// Fails on any error, leaving the serial parse to report it.
+bool Module::parseChunks(unsigned concurrency)
 {
-    lexer::Scanner scanner(stream);
+    // Below this a chunk isn't worth a thread
+    constexpr std::size_t minChunkSize = 64 * 1024;
+
+    auto const first = mySource->begin();
+    auto const last = mySource->end();
+    auto const size = mySource->size();
+    auto const chunkCount = std::min<std::size_t>(concurrency * 4, size / minChunkSize);
+    if ( chunkCount < 2 )
+        return false;
+
+    auto isDeclarationStart = [](char c) {
+        return !lexer::isSpace(c) && !lexer::isLineBreak(c) && c != ';';
+    };
+
+    std::vector<lexer::source_offset_t> bounds;
+    bounds.push_back(0);
+    for ( std::size_t i = 1; i != chunkCount; ++i ) {
+        auto p = std::max(first + size / chunkCount * i, first + bounds.back());
+        for (;;) {
+            p = lexer::findLineBreak(p, last);
+            if ( p == last )
+                break;
+
+            if ( *p++ == '\r' && p != last && *p == '\n' )
+                ++p;
+
+            if ( p != last && isDeclarationStart(*p) )
+                break;
+        }
+
+        if ( p == last )
+            break;
+
+        bounds.push_back(static_cast<lexer::source_offset_t>(p - first));
+    }
+    bounds.push_back(static_cast<lexer::source_offset_t>(size));
+
+    struct Chunk
+    {
+        std::unique_ptr<DeclarationScope> scope;
+        std::vector<SourceSpan> spans;
+        bool ok = false;
+    };
+
+    // One arena per worker, declared first so that a failed parse releases
+    // its chunks before them
+    auto const chunks = bounds.size() - 1;
+    std::vector<std::unique_ptr<Arena>> arenas(std::min<std::size_t>(concurrency, chunks));
+    std::vector<Chunk> results(chunks);
+    std::atomic<std::size_t> nextChunk{ 0 };
+    std::atomic<bool> failed{ false };
+
+    auto work = [&](Arena& arena) {
+        NodeArenaScope arenaScope(arena);
+        for ( auto i = nextChunk++; i < chunks && !failed; i = nextChunk++ ) {
+            auto& chunk = results[i];
+            try {
+                lexer::Scanner scanner(*mySource, myModuleSet->internTable(), lexer::ScanMode::Tokenized,
+                                       bounds[i], bounds[i + 1]);
+
+                // A string running over the chunk's end can't be split
+                for ( auto const& tok : scanner.tokens() ) {
+                    if ( tok.kind() == lexer::TokenKind::Undefined || tok.kind() == lexer::TokenKind::IndentError )
+                        throw std::runtime_error("lexical error");
+                }
+
+                Diagnostics dgn;
+                chunk.scope = std::make_unique<DeclarationScope>(this);
+                parseDeclarations(dgn, scanner, *chunk.scope);
+                chunk.ok = !dgn.errorCount()
+                        && spanDeclarations(scanner.tokens(), bounds[i], bounds[i + 1], mySource->id(),
+                                            chunk.scope->childDeclarations().size(), chunk.spans);
+            }
+            catch (...) {
+            }
+
+            if ( !chunk.ok )
+                failed = true;
+        }
+    };
+
+    for ( auto& a : arenas )
+        a = std::make_unique<Arena>();
+
+    std::vector<std::thread> workers;
+    for ( std::size_t i = 1; i < arenas.size(); ++i )
+        workers.emplace_back(work, std::ref(*arenas[i]));
+
+    work(*arenas.front());
+    for ( auto& w : workers )
+        w.join();
+
+    if ( failed )
+        return false;
 
+    for ( auto& a : arenas )
+        myParseArenas.push_back(std::move(a));
+
+    for ( auto& chunk : results ) {
+        myScope->merge(*chunk.scope);
+        mySpans.insert(end(mySpans), begin(chunk.spans), end(chunk.spans));
+    }
+
+    return true;
+}
+
+void Module::parseDeclarations(Diagnostics& dgn, lexer::Scanner& scanner, DeclarationScope& scope)
+{
     using lexer::TokenKind;
 
-    myScope = std::make_unique<ast::DeclarationScope>(this);
-    
+    scanner.memoize(true);
+
     std::vector<std::unique_ptr<parser::DeclarationScopeParser>> scopeStack;
-    scopeStack.emplace_back(std::make_unique<parser::DeclarationScopeParser>(myScope.get()));
+    scopeStack.emplace_back(std::make_unique<parser::DeclarationScopeParser>(&scope));
 
     while ( scanner ) {
         auto nextScope = scopeStack.back()->next(dgn, scanner);
@@ -183,13 +484,13 @@ void Module::parse(Diagnostics& dgn, std::istream& stream)
 
             case TokenKind::IndentGT:
             {
-                dgn.error(myScope->module(), scanner.peek()) << "unexpected scope opening";
+                dgn.error(scope.module(), scanner.peek()) << "unexpected scope opening";
                 dgn.die();
                 return;
             }
 
             default:
-                dgn.error(myScope->module(), scanner.peek()) << "expected end of scope";
+                dgn.error(scope.module(), scanner.peek()) << "expected end of scope";
                 dgn.die();
             }
 
@@ -214,6 +515,77 @@ void Module::parse(Diagnostics& dgn, std::istream& stream)
         throw std::runtime_error("parser scope imbalance");
 }
 
+// Splits [first, last) at each line starting at indent zero. Each such
+// line begins one top-level declaration; fails if that doesn't hold.
+bool Module::spanDeclarations(std::vector<lexer::Token> const& tokens,
+                              lexer::source_offset_t first,
+                              lexer::source_offset_t last,
+                              lexer::source_id_t source,
+                              std::size_t declarations,
+                              std::vector<SourceSpan>& spans) const
+{
+    using lexer::TokenKind;
+
+    auto const start = spans.size();
+    spans.push_back(SourceSpan{ first, last, source, first });
+
+    std::size_t depth = 0;
+    bool lineStart = false;
+    for ( auto const& tok : tokens ) {
+        switch (tok.kind()) {
+        case TokenKind::IndentGT:
+            ++depth;
+            lineStart = false;
+            break;
+
+        case TokenKind::IndentLT:
+            --depth;
+            lineStart = !depth;
+            break;
+
+        case TokenKind::IndentEQ:
+            lineStart = !depth;
+            break;
+
+        case TokenKind::EndOfFile:
+            break;
+
+        default:
+            if ( lineStart ) {
+                spans.back().last = tok.offset();
+                spans.push_back(SourceSpan{ tok.offset(), last, source, tok.offset() });
+            }
+            lineStart = false;
+        }
+    }
+
+    return spans.size() - start == declarations;
+}
+
+// Points positions of declarations scanned from earlier revisions of the
+// source at the current one, dropping revisions nothing refers to anymore
+void Module::forwardRetiredSources()
+{
+    auto r = begin(myRetiredSources);
+    while ( r != end(myRetiredSources) ) {
+        std::vector<lexer::SourceBuffer::Relocation> relocations;
+        for ( auto const& span : mySpans ) {
+            if ( span.scanned == (*r)->id() )
+                relocations.push_back({ span.scannedFirst,
+                                        static_cast<lexer::source_offset_t>(span.scannedFirst + (span.last - span.first)),
+                                        span.first });
+        }
+
+        if ( relocations.empty() ) {
+            r = myRetiredSources.erase(r);
+            continue;
+        }
+
+        (*r)->forward(mySource.get(), std::move(relocations));
+        ++r;
+    }
+}
+
 void Module::resolveImports(Diagnostics& dgn)
 {
     myScope->resolveImports(dgn);
@@ -221,6 +593,7 @@ void Module::resolveImports(Diagnostics& dgn)
 
 void Module::semantics(Diagnostics& dgn)
 {
+    NodeArenaScope arenaScope(arena());
     myScope->resolveSymbols(dgn);
 }
 
@@ -231,15 +604,17 @@ Module const* Module::import(Module* module)
         return *m;
 
     myImports.push_back(module);
+    symbolsChanged();
     return myImports.back();
 }
 
 Module const* Module::import(Diagnostics& dgn, lexer::Token const& token)
 {
-    auto mod = myModuleSet->create(token.lexeme());
+    std::string const name(token.lexeme());
+    auto mod = myModuleSet->find(name);
     if ( !mod ) {
         fs::path importPath = myPath;
-        importPath.replace_filename(token.lexeme());
+        importPath.replace_filename(name);
         importPath.replace_extension(".kf");
 
         if ( !exists(importPath) ) {
@@ -257,14 +632,36 @@ Module const* Module::import(Diagnostics& dgn, lexer::Token const& token)
             return m;
 
     myImports.push_back(mod);
+    symbolsChanged();
     return myImports.back();
 }
 
 void Module::appendTemplateInstance(Declaration const* instance)
 {
+    std::lock_guard<std::mutex> lock(myTemplateInstancesMutex);
     myTemplateInstantiations.push_back(instance);
 }
 
+std::size_t Module::symbolGeneration() const
+{
+    return mySymbolGeneration.load(std::memory_order_relaxed);
+}
+
+void Module::symbolsChanged()
+{
+    mySymbolGeneration.fetch_add(1, std::memory_order_relaxed);
+}
+
+ModuleSet* Module::moduleSet()
+{
+    return myModuleSet;
+}
+
+ModuleSet const* Module::moduleSet() const
+{
+    return myModuleSet;
+}
+
 AxiomsModule* Module::axioms()
 {
     return myModuleSet->axioms();
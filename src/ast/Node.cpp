@@ -0,0 +1,58 @@
+#include <kyfoo/ast/Node.hpp>
+
+#include <cstddef>
+#include <new>
+
+#include <kyfoo/Arena.hpp>
+
+namespace kyfoo {
+    namespace ast {
+
+namespace
+{
+    thread_local Arena* theNodeArena = nullptr;
+
+    // Precedes every node to say where its memory came from
+    struct alignas(std::max_align_t) NodeHeader
+    {
+        bool inArena;
+    };
+}
+
+//
+// INode
+
+void* INode::operator new(std::size_t size)
+{
+    if ( theNodeArena )
+        return new (theNodeArena->allocate(sizeof(NodeHeader) + size, alignof(NodeHeader))) NodeHeader{ true } + 1;
+
+    return new (::operator new(sizeof(NodeHeader) + size)) NodeHeader{ false } + 1;
+}
+
+void INode::operator delete(void* p)
+{
+    if ( !p )
+        return;
+
+    auto header = static_cast<NodeHeader*>(p) - 1;
+    if ( !header->inArena )
+        ::operator delete(header);
+}
+
+//
+// NodeArenaScope
+
+NodeArenaScope::NodeArenaScope(Arena& arena)
+    : myPrevious(theNodeArena)
+{
+    theNodeArena = &arena;
+}
+
+NodeArenaScope::~NodeArenaScope()
+{
+    theNodeArena = myPrevious;
+}
+
+    } // namespace ast
+} // namespace kyfoo
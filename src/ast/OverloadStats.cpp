@@ -0,0 +1,121 @@
+#include <kyfoo/ast/OverloadStats.hpp>
+
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <kyfoo/lexer/Token.hpp>
+#include <kyfoo/ast/Module.hpp>
+
+namespace kyfoo {
+    namespace ast {
+
+#ifdef KYFOO_OVERLOAD_STATS
+
+namespace
+{
+    struct CallSite
+    {
+        std::string name;
+        std::size_t lookups = 0;
+        CandidateCounts candidates;
+    };
+
+    using site_key_t = std::tuple<Module const*, lexer::line_index_t, lexer::column_index_t>;
+
+    struct Registry
+    {
+        std::mutex mutex;
+        std::map<site_key_t, CallSite> sites;
+    };
+
+    Registry& registry()
+    {
+        static Registry r;
+        return r;
+    }
+}
+
+void recordOverloadLookup(Module const* module,
+                          lexer::Token const& site,
+                          CandidateCounts const& candidates)
+{
+    auto& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    auto& s = r.sites[site_key_t(module, site.line(), site.column())];
+    if ( s.name.empty() )
+        s.name = std::string(site.lexeme());
+
+    ++s.lookups;
+    s.candidates += candidates;
+}
+
+bool overloadStatsEnabled()
+{
+    return true;
+}
+
+void resetOverloadStats()
+{
+    auto& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.sites.clear();
+}
+
+void printOverloadStats(std::ostream& stream)
+{
+    auto& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+
+    using row_t = std::pair<site_key_t const, CallSite> const*;
+    std::vector<row_t> rows;
+    for ( auto const& s : r.sites )
+        rows.push_back(&s);
+
+    std::stable_sort(begin(rows), end(rows), [](row_t lhs, row_t rhs) {
+        return lhs->second.candidates.considered > rhs->second.candidates.considered;
+    });
+
+    stream << std::setw(10) << "lookups"
+           << std::setw(12) << "prototypes"
+           << std::setw(12) << "considered"
+           << std::setw(10) << "matched"
+           << "  call site\n";
+
+    for ( auto s : rows ) {
+        auto const& c = s->second.candidates;
+        stream << std::setw(10) << s->second.lookups
+               << std::setw(12) << c.prototypes
+               << std::setw(12) << c.considered
+               << std::setw(10) << c.matched
+               << "  " << std::get<0>(s->first)->name()
+               << '(' << std::get<1>(s->first) << ", " << std::get<2>(s->first) << ") "
+               << s->second.name << '\n';
+    }
+}
+
+#else
+
+bool overloadStatsEnabled()
+{
+    return false;
+}
+
+void resetOverloadStats()
+{
+}
+
+void printOverloadStats(std::ostream& stream)
+{
+    stream << "overload statistics require building with KYFOO_OVERLOAD_STATS\n";
+}
+
+#endif
+
+    } // namespace ast
+} // namespace kyfoo
@@ -0,0 +1,75 @@
+#include <kyfoo/ast/Passes.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <kyfoo/ast/Declarations.hpp>
+#include <kyfoo/ast/Module.hpp>
+#include <kyfoo/ast/Scopes.hpp>
+
+namespace kyfoo {
+    namespace ast {
+
+//
+// PassManager
+
+PassManager::PassManager() = default;
+PassManager::~PassManager() = default;
+
+PassManager::pass_id PassManager::add(pass_t pass, unsigned coverage)
+{
+    myPasses.push_back(Pass{ std::move(pass), coverage, {} });
+    return myPasses.size() - 1;
+}
+
+void PassManager::depend(pass_id pass, pass_id dependency, PassDependency kind)
+{
+    // Passes run in the order they are added
+    if ( pass >= myPasses.size() || dependency >= pass )
+        throw std::runtime_error("pass must be added after its dependencies");
+
+    if ( kind == PassDependency::Module )
+        myPasses[pass].moduleDependencies.push_back(dependency);
+}
+
+std::vector<std::vector<PassManager::pass_id>> PassManager::plan() const
+{
+    std::vector<std::vector<pass_id>> ret;
+    for ( pass_id i = 0; i != myPasses.size(); ++i ) {
+        auto const& deps = myPasses[i].moduleDependencies;
+        auto const fuse = !ret.empty() && none_of(begin(deps), end(deps), [&ret](pass_id d) {
+            auto const& walk = ret.back();
+            return find(begin(walk), end(walk), d) != end(walk);
+        });
+
+        if ( !fuse )
+            ret.emplace_back();
+
+        ret.back().push_back(i);
+    }
+
+    return ret;
+}
+
+std::size_t PassManager::walks() const
+{
+    return plan().size();
+}
+
+void PassManager::run(Module const& module) const
+{
+    for ( auto const& walk : plan() ) {
+        for ( auto d : module.scope()->childDeclarations() )
+            for ( auto p : walk )
+                if ( myPasses[p].coverage & Declarations )
+                    myPasses[p].run(*d);
+
+        for ( auto d : module.templateInstantiations() )
+            for ( auto p : walk )
+                if ( myPasses[p].coverage & Instances )
+                    myPasses[p].run(*d);
+    }
+}
+
+    } // namespace ast
+} // namespace kyfoo
@@ -1,5 +1,6 @@
 #include <kyfoo/ast/Scopes.hpp>
 
+#include <algorithm>
 #include <cassert>
 
 #include <kyfoo/Diagnostics.hpp>
@@ -62,6 +63,9 @@ void DeclarationScope::swap(DeclarationScope& rhs)
     swap(mySymbols, rhs.mySymbols);
     swap(myProcedureOverloads, rhs.myProcedureOverloads);
     swap(myImports, rhs.myImports);
+
+    clearLookups();
+    rhs.clearLookups();
 }
 
 void DeclarationScope::io(IStream& stream) const
@@ -94,11 +98,10 @@ void DeclarationScope::resolveSymbols(Diagnostics& dgn)
     for ( auto const& d : myDeclarations )
         traceDependencies(tracker, *d);
 
+    tracker.sortPasses();
     if ( dgn.errorCount() )
         return;
 
-    tracker.sortPasses();
-
     ScopeResolver resolver(this);
 
     // Resolve top-level declarations
@@ -145,12 +148,16 @@ void DeclarationScope::resolveSymbols(Diagnostics& dgn)
  */
 LookupHit DeclarationScope::findEquivalent(SymbolReference const& symbol) const
 {
-    auto symSet = findSymbol(symbol.name());
+    return findEquivalent(findSymbol(symbol.id()), symbol);
+}
+
+LookupHit DeclarationScope::findEquivalent(SymbolSet const* symSet, SymbolReference const& symbol) const
+{
     if ( symSet )
         return LookupHit(symSet, symSet->findEquivalent(symbol.parameters()));
 
     if ( myDeclaration && symbol.parameters().empty() )
-        return LookupHit(symSet, myDeclaration->symbol().findVariable(symbol.name()));
+        return LookupHit(symSet, myDeclaration->symbol().findVariable(symbol.id()));
 
     return LookupHit();
 }
@@ -176,31 +183,41 @@ LookupHit DeclarationScope::findEquivalent(SymbolReference const& symbol) const
  * \endcode
  */
 LookupHit DeclarationScope::findValue(Diagnostics& dgn, SymbolReference const& symbol) const
+{
+    return findValue(dgn, findSymbol(symbol.id()), symbol);
+}
+
+LookupHit DeclarationScope::findValue(Diagnostics& dgn, SymbolSet const* symSet, SymbolReference const& symbol) const
 {
     LookupHit hit;
-    auto symSet = findSymbol(symbol.name());
     if ( symSet ) {
         auto t = symSet->findValue(dgn, symbol.parameters());
         if ( t.instance )
             myModule->appendTemplateInstance(t.instance);
 
-        hit.lookup(symSet, t.instance ? t.instance : t.parent);
+        hit.lookup(symSet, t.instance ? t.instance : t.parent)
+           .addCandidates(t.candidates);
     }
 
     return hit;
 }
 
 LookupHit DeclarationScope::findProcedureOverload(Diagnostics& dgn, SymbolReference const& procOverload) const
+{
+    return findProcedureOverload(dgn, findProcedure(procOverload.id()), procOverload);
+}
+
+LookupHit DeclarationScope::findProcedureOverload(Diagnostics& dgn, SymbolSet const* procSet, SymbolReference const& procOverload) const
 {
     LookupHit hit;
-    auto symSet = findProcedure(procOverload.name());
-    if ( symSet ) {
-        auto t = symSet->findValue(dgn, procOverload.parameters());
+    if ( procSet ) {
+        auto t = procSet->findValue(dgn, procOverload.parameters());
         auto decl = t.instance ? t.instance : t.parent;
         if ( t.instance )
             myModule->appendTemplateInstance(t.instance);
 
-        hit.lookup(symSet, static_cast<ProcedureDeclaration const*>(decl));
+        hit.lookup(procSet, static_cast<ProcedureDeclaration const*>(decl))
+           .addCandidates(t.candidates);
     }
 
     return hit;
@@ -213,40 +230,57 @@ void DeclarationScope::setDeclaration(Declaration* declaration)
 
 void DeclarationScope::append(std::unique_ptr<Declaration> declaration)
 {
+    std::lock_guard<std::mutex> lock(myMutex);
     myDeclarations.emplace_back(std::move(declaration));
     myDeclarations.back()->setScope(*this);
 }
 
-void DeclarationScope::import(Module& module)
+// Replaces declarations [first, last) with those appended from tail onward
+void DeclarationScope::replaceDeclarations(std::size_t first, std::size_t last, std::size_t tail)
+{
+    auto const b = begin(myDeclarations);
+    std::rotate(b + first, b + tail, end(myDeclarations));
+
+    auto const replaced = b + first + (myDeclarations.size() - tail);
+    myDeclarations.erase(replaced, replaced + (last - first));
+}
+
+// Moves the declarations of a scope parsed apart from this one to its end
+void DeclarationScope::merge(DeclarationScope& fragment)
 {
-    append(
-        std::make_unique<ImportDeclaration>(
-            Symbol(lexer::Token(lexer::TokenKind::Identifier, 0, 0, module.name()))));
+    clone_map_t map;
+    map[&fragment] = this;
+
+    myDeclarations.reserve(myDeclarations.size() + fragment.myDeclarations.size());
+    for ( auto& d : fragment.myDeclarations ) {
+        d->remapReferences(map);
+        myDeclarations.emplace_back(std::move(d));
+    }
+
+    fragment.myDeclarations.clear();
 }
 
-SymbolSet* DeclarationScope::createSymbolSet(std::string const& name)
+SymbolSet* DeclarationScope::createSymbolSet(std::string_view name, lexer::intern_id_t id)
 {
-    auto l = lower_bound(begin(mySymbols), end(mySymbols), name);
-    if ( l != end(mySymbols) && l->name() == name )
-        return &*l;
+    auto e = mySymbols.try_emplace(id, this, name, id);
+    if ( e.second )
+        myModule->symbolsChanged();
 
-    l = mySymbols.insert(l, SymbolSet(this, name));
-    return &*l;
+    return &e.first->second;
 }
 
-SymbolSet* DeclarationScope::createProcedureOverloadSet(std::string const& name)
+SymbolSet* DeclarationScope::createProcedureOverloadSet(std::string_view name, lexer::intern_id_t id)
 {
-    auto l = lower_bound(begin(myProcedureOverloads), end(myProcedureOverloads), name);
-    if ( l != end(myProcedureOverloads) && l->name() == name )
-        return &*l;
+    auto e = myProcedureOverloads.try_emplace(id, this, name, id);
+    if ( e.second )
+        myModule->symbolsChanged();
 
-    l = myProcedureOverloads.insert(l, SymbolSet(this, name));
-    return &*l;
+    return &e.first->second;
 }
 
 bool DeclarationScope::addSymbol(Diagnostics& dgn, Symbol const& sym, Declaration& decl)
 {
-    auto symSet = createSymbolSet(sym.name());
+    auto symSet = createSymbolSet(sym.name(), sym.id());
     if ( auto other = symSet->findEquivalent(sym.parameters()) ) {
         auto& err = dgn.error(module(), sym.identifier()) << "symbol is already defined";
         err.see(other);
@@ -259,7 +293,7 @@ bool DeclarationScope::addSymbol(Diagnostics& dgn, Symbol const& sym, Declaratio
 
 bool DeclarationScope::addProcedure(Diagnostics& dgn, Symbol const& sym, ProcedureDeclaration& procDecl)
 {
-    auto procSet = createProcedureOverloadSet(sym.name());
+    auto procSet = createProcedureOverloadSet(sym.name(), sym.id());
     if ( auto other = procSet->findEquivalent(sym.parameters()) ) {
         auto& err = dgn.error(module(), sym.identifier()) << "procedure declaration conflicts with existing overload";
         err.see(other);
@@ -275,24 +309,78 @@ bool DeclarationScope::addProcedure(Diagnostics& dgn, Symbol const& sym, Procedu
     return true;
 }
 
-SymbolSet const* DeclarationScope::findSymbol(std::string const& identifier) const
+SymbolSet const* DeclarationScope::findSymbol(lexer::intern_id_t id) const
 {
-    auto symSet = lower_bound(begin(mySymbols), end(mySymbols), identifier);
-    if ( symSet != end(mySymbols) && symSet->name() == identifier )
-        return &*symSet;
+    auto symSet = mySymbols.find(id);
+    if ( symSet != end(mySymbols) )
+        return &symSet->second;
 
     return nullptr;
 }
 
-SymbolSet const* DeclarationScope::findProcedure(std::string const& identifier) const
+SymbolSet const* DeclarationScope::findProcedure(lexer::intern_id_t id) const
 {
-    auto procOverloads = lower_bound(begin(myProcedureOverloads), end(myProcedureOverloads), identifier);
-    if ( procOverloads != end(myProcedureOverloads) && procOverloads->name() == identifier )
-        return &*procOverloads;
+    auto procOverloads = myProcedureOverloads.find(id);
+    if ( procOverloads != end(myProcedureOverloads) )
+        return &procOverloads->second;
 
     return nullptr;
 }
 
+DeclarationScope::visible_sets_t DeclarationScope::visibleSymbols(lexer::intern_id_t id) const
+{
+    return visible(myVisibleSymbols, &DeclarationScope::findSymbol, id);
+}
+
+DeclarationScope::visible_sets_t DeclarationScope::visibleProcedures(lexer::intern_id_t id) const
+{
+    return visible(myVisibleProcedures, &DeclarationScope::findProcedure, id);
+}
+
+DeclarationScope::visible_sets_t
+DeclarationScope::visible(visible_cache_t& cache,
+                          SymbolSet const* (DeclarationScope::*find)(lexer::intern_id_t) const,
+                          lexer::intern_id_t id) const
+{
+    auto const generation = lookupGeneration();
+    std::lock_guard<std::mutex> lock(myMutex);
+    auto& e = cache[id];
+    if ( e.sets && e.generation == generation )
+        return e.sets;
+
+    // Callers may still be walking the previous list, so it is replaced
+    // rather than refilled
+    auto sets = std::make_shared<std::vector<VisibleSet>>();
+    for ( DeclarationScope const* scope = this; scope; scope = scope->myParent )
+        if ( auto s = (scope->*find)(id) )
+            sets->push_back(VisibleSet{ scope, s });
+
+    for ( auto m : myModule->imports() )
+        if ( auto s = (m->scope()->*find)(id) )
+            sets->push_back(VisibleSet{ m->scope(), s });
+
+    e.generation = generation;
+    e.sets = std::move(sets);
+    return e.sets;
+}
+
+// Sums the generations the cached lookups depend on; any change to them
+// changes the sum
+std::size_t DeclarationScope::lookupGeneration() const
+{
+    auto ret = myModule->symbolGeneration();
+    for ( auto m : myModule->imports() )
+        ret += m->symbolGeneration();
+
+    return ret;
+}
+
+void DeclarationScope::clearLookups()
+{
+    myVisibleSymbols.clear();
+    myVisibleProcedures.clear();
+}
+
 Module* DeclarationScope::module()
 {
     return myModule;
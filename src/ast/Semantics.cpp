@@ -46,6 +46,11 @@ namespace {
         // todo: print diagnostics on mismatch
         return matchEquivalent(*e->second, expr);
     }
+
+    std::uint64_t groupKey(lexer::intern_id_t id, std::size_t arity)
+    {
+        return std::uint64_t(id) << 32 | std::uint64_t(arity);
+    }
 } // namespace
 
 //
@@ -57,49 +62,136 @@ SymbolDependencyTracker::SymbolDependencyTracker(Module* mod, Diagnostics& dgn)
 {
 }
 
-SymbolDependencyTracker::SymGroup* SymbolDependencyTracker::create(std::string const& name, std::size_t arity)
+SymbolDependencyTracker::SymGroup* SymbolDependencyTracker::create(lexer::intern_id_t id, std::size_t arity)
 {
-    groups.emplace_back(std::make_unique<SymGroup>(name, arity));
+    groups.emplace_back(std::make_unique<SymGroup>(id, arity));
+    index[groupKey(id, arity)] = groups.back().get();
     return groups.back().get();
 }
 
-SymbolDependencyTracker::SymGroup* SymbolDependencyTracker::findOrCreate(std::string const& name, std::size_t arity)
+SymbolDependencyTracker::SymGroup* SymbolDependencyTracker::findOrCreate(lexer::intern_id_t id, std::size_t arity)
 {
-    for ( auto const& e : groups)
-        if ( e->name == name && e->arity == arity )
-            return e.get();
+    auto e = index.find(groupKey(id, arity));
+    if ( e != end(index) )
+        return e->second;
 
-    return create(name, arity);
+    return create(id, arity);
 }
 
 void SymbolDependencyTracker::add(Declaration& decl)
 {
-    auto group = findOrCreate(decl.symbol().name(), decl.symbol().parameters().size());
+    auto group = findOrCreate(decl.symbol().id(), decl.symbol().parameters().size());
+    if ( group->declarations.empty() )
+        group->order = declared;
+
+    ++declared;
     group->add(decl);
 }
 
 void SymbolDependencyTracker::addDependency(Declaration& decl,
-                               std::string const& name,
+                               lexer::intern_id_t id,
                                std::size_t arity)
 {
-    auto group = findOrCreate(decl.symbol().name(), decl.symbol().parameters().size());
-    auto dependency = findOrCreate(name, arity);
+    auto group = findOrCreate(decl.symbol().id(), decl.symbol().parameters().size());
+    auto dependency = findOrCreate(id, arity);
 
-    dependency->addDependent(*group);
-
-    if ( group->pass < dependency->pass ) {
-        auto& err = dgn.error(mod, decl.symbol().identifier()) << "circular reference detected";
-        for ( auto const& d : dependency->declarations )
-            err.see(d);
-        return;
-    }
-    else if ( group->pass == dependency->pass ) {
-        group->defer(dependency->pass + 1);
-    }
+    group->addDependency(*dependency);
+    references.push_back(Reference{ &decl, group, dependency });
 }
 
+/**
+ * Orders groups so that each follows the groups it depends on
+ *
+ * Strongly connected groups are found with an iterative Tarjan's algorithm,
+ * which completes a component only after every component it depends on.
+ * Each group's pass is one past the deepest pass among those components.
+ * A component of several groups is circular, and is reported at each
+ * reference back to a group declared earlier in the scope.
+ */
 void SymbolDependencyTracker::sortPasses()
 {
+    auto const unvisited = std::size_t(-1);
+    auto const n = groups.size();
+
+    std::unordered_map<SymGroup const*, std::size_t> slot;
+    slot.reserve(n);
+    for ( std::size_t i = 0; i != n; ++i )
+        slot[groups[i].get()] = i;
+
+    std::vector<std::size_t> visited(n, unvisited);
+    std::vector<std::size_t> low(n);
+    std::vector<std::size_t> component(n, unvisited);
+    std::vector<std::size_t> stack;
+    std::vector<std::pair<std::size_t, std::size_t>> frames; // group, next dependency
+    std::size_t counter = 0;
+    std::size_t components = 0;
+
+    auto enter = [&](std::size_t v) {
+        visited[v] = low[v] = counter++;
+        stack.push_back(v);
+        frames.emplace_back(v, 0);
+    };
+
+    for ( std::size_t root = 0; root != n; ++root ) {
+        if ( visited[root] != unvisited )
+            continue;
+
+        enter(root);
+        while ( !frames.empty() ) {
+            auto const v = frames.back().first;
+            auto const& deps = groups[v]->dependencies;
+            if ( frames.back().second != deps.size() ) {
+                auto const w = slot[deps[frames.back().second++]];
+                if ( visited[w] == unvisited )
+                    enter(w);
+                else if ( component[w] == unvisited )
+                    low[v] = std::min(low[v], visited[w]);
+
+                continue;
+            }
+
+            frames.pop_back();
+            if ( !frames.empty() ) {
+                auto const u = frames.back().first;
+                low[u] = std::min(low[u], low[v]);
+            }
+
+            if ( low[v] != visited[v] )
+                continue;
+
+            // v roots a component made of itself and the groups above it
+            auto first = end(stack);
+            while ( *--first != v )
+                ;
+
+            int pass = 0;
+            for ( auto m = first; m != end(stack); ++m )
+                component[*m] = components;
+
+            for ( auto m = first; m != end(stack); ++m )
+                for ( auto d : groups[*m]->dependencies )
+                    if ( component[slot[d]] != components )
+                        pass = std::max(pass, d->pass + 1);
+
+            for ( auto m = first; m != end(stack); ++m )
+                groups[*m]->pass = pass;
+
+            stack.erase(first, end(stack));
+            ++components;
+        }
+    }
+
+    for ( auto const& r : references ) {
+        if ( r.from == r.to || component[slot[r.from]] != component[slot[r.to]] )
+            continue;
+
+        if ( r.to->order < r.from->order ) {
+            auto& err = dgn.error(mod, r.decl->symbol().identifier()) << "circular reference detected";
+            for ( auto const& d : r.to->declarations )
+                err.see(d);
+        }
+    }
+
     stable_sort(begin(groups), end(groups),
                 [](auto const& lhs, auto const& rhs) { return lhs->pass < rhs->pass; });
 }
@@ -129,7 +221,7 @@ struct SymbolDependencyBuilder
     result_t exprPrimary(PrimaryExpression& p)
     {
         if ( p.token().kind() == lexer::TokenKind::Identifier )
-            tracker.addDependency(decl, p.token().lexeme(), 0);
+            tracker.addDependency(decl, p.token().id(), 0);
     }
 
     result_t exprTuple(TupleExpression& t)
@@ -143,7 +235,7 @@ struct SymbolDependencyBuilder
         // todo: failover to implicit proc call semantics
         auto subject = a.expressions()[0]->as<PrimaryExpression>();
         if ( subject && subject->token().kind() == lexer::TokenKind::Identifier ) {
-            tracker.addDependency(decl, subject->token().lexeme(), a.expressions().size() - 1);
+            tracker.addDependency(decl, subject->token().id(), a.expressions().size() - 1);
             return;
         }
 
@@ -154,7 +246,7 @@ struct SymbolDependencyBuilder
     result_t exprSymbol(SymbolExpression& s)
     {
         if ( s.identifier().kind() == lexer::TokenKind::Identifier ) {
-            tracker.addDependency(decl, s.identifier().lexeme(), s.expressions().size());
+            tracker.addDependency(decl, s.identifier().id(), s.expressions().size());
             return;
         }
 
@@ -469,6 +561,10 @@ struct MatchEquivalent
  */
 bool matchEquivalent(Expression const& lhs, Expression const& rhs)
 {
+    // Concrete types are uniqued, so identity decides
+    if ( lhs.canonical() && rhs.canonical() )
+        return lhs.canonical() == rhs.canonical();
+
     MatchEquivalent op;
     return noncommute(op, lhs, rhs);
 }
@@ -479,6 +575,72 @@ bool matchEquivalent(Slice<Expression*> lhs, Slice<Expression*> rhs)
     return compare(lhs, rhs, op);
 }
 
+namespace {
+    void hashCombine(std::size_t& seed, std::size_t value)
+    {
+        seed ^= value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+    }
+} // namespace
+
+/**
+ * Structural hash agreeing with matchEquivalent
+ *
+ * Expressions that match equivalently hash the same. Symbol aliases are
+ * hashed through to what they name, and tuple/symbol names are ignored as
+ * matchEquivalent ignores them.
+ *
+ * \return false if \p expr has no canonical hash, as when it mentions a
+ *         symbol variable (which matches anything)
+ */
+bool hashEquivalent(Expression const& expr, std::size_t& hash)
+{
+    hashCombine(hash, static_cast<std::size_t>(expr.kind()));
+
+    if ( auto p = expr.as<PrimaryExpression>() ) {
+        if ( !isIdentifier(p->token().kind()) ) {
+            hashCombine(hash, std::hash<std::string_view>()(p->token().lexeme()));
+            return true;
+        }
+
+        auto decl = p->declaration();
+        if ( !decl || decl->kind() == DeclKind::SymbolVariable )
+            return false;
+
+        if ( auto s = decl->as<SymbolDeclaration>() )
+            return hashEquivalent(*s->expression(), hash);
+
+        hashCombine(hash, std::hash<void const*>()(decl));
+        return true;
+    }
+
+    Slice<Expression*> children;
+    if ( auto t = expr.as<TupleExpression>() )
+        children = t->expressions();
+    else if ( auto a = expr.as<ApplyExpression>() )
+        children = a->expressions();
+    else if ( auto s = expr.as<SymbolExpression>() )
+        children = s->expressions();
+    else
+        return false;
+
+    hashCombine(hash, children.size());
+    for ( auto const& e : children )
+        if ( !hashEquivalent(*e, hash) )
+            return false;
+
+    return true;
+}
+
+bool hashEquivalent(binding_set_t const& bindings, std::size_t& hash)
+{
+    hashCombine(hash, bindings.size());
+    for ( auto const& e : bindings )
+        if ( !hashEquivalent(*e.second, hash) )
+            return false;
+
+    return true;
+}
+
 struct MatchInstantiable
 {
     binding_set_t& bindingSet;
@@ -775,6 +937,145 @@ bool ValueMatcher::matchValue(Slice<Expression*> lhs, Slice<Expression*> rhs)
     return compare(lhs, rhs, op);
 }
 
+//
+// TypeTable
+
+namespace {
+    Slice<Expression*> subExpressions(Expression const& expr)
+    {
+        if ( auto t = expr.as<TupleExpression>() )
+            return t->expressions();
+
+        if ( auto a = expr.as<ApplyExpression>() )
+            return a->expressions();
+
+        if ( auto s = expr.as<SymbolExpression>() )
+            return s->expressions();
+
+        return Slice<Expression*>();
+    }
+
+    // What identifies a canonical node besides its sub-expressions
+    struct TypeKey
+    {
+        Expression::Kind kind;
+        int variant = 0;
+        Declaration const* decl = nullptr;
+        std::string_view lexeme;
+
+        bool operator == (TypeKey const& rhs) const
+        {
+            return kind == rhs.kind
+                && variant == rhs.variant
+                && decl == rhs.decl
+                && lexeme == rhs.lexeme;
+        }
+    };
+
+    TypeKey typeKey(Expression const& expr)
+    {
+        TypeKey key{ expr.kind(), 0, nullptr, std::string_view() };
+        if ( auto p = expr.as<PrimaryExpression>() ) {
+            if ( isIdentifier(p->token().kind()) ) {
+                key.decl = p->declaration();
+            }
+            else {
+                key.variant = static_cast<int>(p->token().kind());
+                key.lexeme = p->token().lexeme();
+            }
+        }
+        else {
+            if ( auto t = expr.as<TupleExpression>() )
+                key.variant = static_cast<int>(t->kind());
+
+            key.decl = expr.declaration();
+        }
+
+        return key;
+    }
+} // namespace
+
+TypeTable::TypeTable() = default;
+TypeTable::~TypeTable() = default;
+
+Expression const* TypeTable::canonical(Expression const& expr)
+{
+    if ( expr.myCanonical )
+        return expr.myCanonical;
+
+    if ( auto p = expr.as<PrimaryExpression>() ) {
+        if ( isIdentifier(p->token().kind()) ) {
+            auto decl = p->declaration();
+            if ( !decl || decl->kind() == DeclKind::SymbolVariable )
+                return nullptr;
+
+            if ( auto s = decl->as<SymbolDeclaration>() )
+                return s->expression() ? canonical(*s->expression()) : nullptr;
+        }
+    }
+    else if ( !expr.as<TupleExpression>() && !expr.declaration() ) {
+        return nullptr;
+    }
+
+    auto const subs = subExpressions(expr);
+    std::vector<Expression const*> children;
+    children.reserve(subs.size());
+    for ( auto const& e : subs ) {
+        auto c = canonical(*e);
+        if ( !c )
+            return nullptr;
+
+        children.push_back(c);
+    }
+
+    auto const key = typeKey(expr);
+    std::size_t hash = 0;
+    hashCombine(hash, static_cast<std::size_t>(key.kind));
+    hashCombine(hash, static_cast<std::size_t>(key.variant));
+    hashCombine(hash, std::hash<void const*>()(key.decl));
+    hashCombine(hash, std::hash<std::string_view>()(key.lexeme));
+    for ( auto c : children )
+        hashCombine(hash, std::hash<void const*>()(c));
+
+    std::lock_guard<std::mutex> lock(myMutex);
+    auto const range = myTypes.equal_range(hash);
+    for ( auto e = range.first; e != range.second; ++e ) {
+        auto const& type = *e->second;
+        if ( !(typeKey(type) == key) )
+            continue;
+
+        auto const typeSubs = subExpressions(type);
+        auto const size = children.size();
+        if ( typeSubs.size() != size )
+            continue;
+
+        std::size_t i = 0;
+        while ( i != size && typeSubs[i]->myCanonical == children[i] )
+            ++i;
+
+        if ( i == size )
+            return &type;
+    }
+
+    clone_map_t map;
+    std::unique_ptr<Expression> type(expr.clone(map));
+    type->myCanonical = type.get();
+
+    auto const typeSubs = subExpressions(*type);
+    for ( std::size_t i = 0; i != children.size(); ++i )
+        typeSubs[i]->myCanonical = children[i];
+
+    auto ret = type.get();
+    myTypes.emplace(hash, std::move(type));
+    return ret;
+}
+
+std::size_t TypeTable::size() const
+{
+    std::lock_guard<std::mutex> lock(myMutex);
+    return myTypes.size();
+}
+
 template <typename Dispatcher>
 struct FreeVariableVisitor
 {
@@ -1,5 +1,7 @@
 #include <kyfoo/ast/Symbol.hpp>
 
+#include <algorithm>
+
 #include <kyfoo/Diagnostics.hpp>
 #include <kyfoo/ast/Declarations.hpp>
 #include <kyfoo/ast/Expressions.hpp>
@@ -13,11 +15,6 @@ namespace kyfoo {
 //
 // Symbol
 
-Symbol::Symbol(std::string const& name)
-    : Symbol(lexer::Token(lexer::TokenKind::Identifier, 0, 0, name))
-{
-}
-
 Symbol::Symbol(lexer::Token const& identifier,
                std::vector<std::unique_ptr<Expression>>&& parameters)
     : myIdentifier(identifier)
@@ -90,7 +87,7 @@ IMPL_CLONE_REMAP_END
 
 bool Symbol::operator == (Symbol const& rhs) const
 {
-    return name() == rhs.name() && matchEquivalent(parameters(), rhs.parameters());
+    return id() == rhs.id() && matchEquivalent(parameters(), rhs.parameters());
 }
 
 lexer::Token const& Symbol::identifier() const
@@ -98,11 +95,16 @@ lexer::Token const& Symbol::identifier() const
     return myIdentifier;
 }
 
-std::string const& Symbol::name() const
+std::string_view Symbol::name() const
 {
     return myIdentifier.lexeme();
 }
 
+lexer::intern_id_t Symbol::id() const
+{
+    return myIdentifier.id();
+}
+
 Symbol::paramlist_t const& Symbol::parameters() const
 {
     return myParameters;
@@ -139,7 +141,7 @@ void Symbol::resolveSymbols(Diagnostics& dgn, IResolver& resolver)
     for ( auto const& param : myParameters ) {
         auto fv = gatherFreeVariables(*param);
         for ( auto& primary : fv ) {
-            auto symVar = createVariable(primary->token().lexeme());
+            auto symVar = createVariable(primary->token());
             if ( !symVar )
                 ctx.error(*primary) << "invalid symbol variable";
             else
@@ -147,7 +149,7 @@ void Symbol::resolveSymbols(Diagnostics& dgn, IResolver& resolver)
         }
     }
 
-    ctx.resolveExpressions(myParameters);
+    ctx.resolveTypes(myParameters);
 }
 
 void Symbol::bindVariables(Diagnostics& dgn, IResolver& resolver, binding_set_t const& bindings)
@@ -156,7 +158,7 @@ void Symbol::bindVariables(Diagnostics& dgn, IResolver& resolver, binding_set_t
         throw std::runtime_error("template parameter binding mismatch");
 
     for ( auto const& e : bindings ) {
-        auto var = findVariable(e.first->name());
+        auto var = findVariable(e.first->symbol().id());
         if ( !var )
             throw std::runtime_error("template parameter binding mismatch");
 
@@ -164,26 +166,26 @@ void Symbol::bindVariables(Diagnostics& dgn, IResolver& resolver, binding_set_t
     }
 
     Context ctx(dgn, resolver);
-    ctx.resolveExpressions(myParameters);
+    ctx.resolveTypes(myParameters);
 }
 
-SymbolVariable* Symbol::findVariable(std::string const& identifier)
+SymbolVariable* Symbol::findVariable(lexer::intern_id_t id)
 {
     for ( auto& e : myVariables )
-        if ( e->identifier().lexeme() == identifier )
+        if ( e->symbol().id() == id )
             return e.get();
 
     return nullptr;
 }
 
-SymbolVariable const* Symbol::findVariable(std::string const& identifier) const
+SymbolVariable const* Symbol::findVariable(lexer::intern_id_t id) const
 {
-    return const_cast<Symbol*>(this)->findVariable(identifier);
+    return const_cast<Symbol*>(this)->findVariable(id);
 }
 
-SymbolVariable* Symbol::createVariable(std::string const& identifier)
+SymbolVariable* Symbol::createVariable(lexer::Token const& identifier)
 {
-    if ( auto symvar = findVariable(identifier) )
+    if ( auto symvar = findVariable(identifier.id()) )
         return symvar;
 
     myVariables.emplace_back(std::make_unique<SymbolVariable>(*this, identifier));
@@ -194,27 +196,37 @@ SymbolVariable* Symbol::createVariable(std::string const& identifier)
 // SymbolReference
 
 SymbolReference::SymbolReference(Symbol const& symbol)
-    : SymbolReference(symbol.name(), symbol.parameters())
+    : SymbolReference(symbol.identifier(), symbol.parameters())
 {
 }
 
-SymbolReference::SymbolReference(std::string const& name)
-    : SymbolReference(name, paramlist_t())
+SymbolReference::SymbolReference(lexer::Token const& identifier)
+    : SymbolReference(identifier, paramlist_t())
 {
 }
 
-SymbolReference::SymbolReference(std::string const& name,
+SymbolReference::SymbolReference(lexer::Token const& identifier,
                                  paramlist_t parameters)
-    : myName(&name)
+    : myIdentifier(identifier)
     , myParameters(parameters)
 {
 }
 
 SymbolReference::~SymbolReference() = default;
 
-std::string const& SymbolReference::name() const
+lexer::Token const& SymbolReference::identifier() const
+{
+    return myIdentifier;
+}
+
+std::string_view SymbolReference::name() const
+{
+    return myIdentifier.lexeme();
+}
+
+lexer::intern_id_t SymbolReference::id() const
 {
-    return *myName;
+    return myIdentifier.id();
 }
 
 SymbolReference::paramlist_t const& SymbolReference::parameters() const
@@ -225,16 +237,74 @@ SymbolReference::paramlist_t const& SymbolReference::parameters() const
 //
 // SymbolSet
 
-SymbolSet::SymbolSet(DeclarationScope* scope, std::string const& name)
+namespace {
+    // Resolving an instance looks up and instantiates in other sets, so
+    // instantiation takes this one lock rather than the set's: threads
+    // cannot then wait on each other's sets in opposite orders
+    std::recursive_mutex& instantiationMutex()
+    {
+        static std::recursive_mutex mutex;
+        return mutex;
+    }
+
+    // Declaration a prototype parameter requires of matching values, when
+    // it requires one; follows aliases as ValueMatcher does
+    Declaration const* concreteKey(Expression const& param)
+    {
+        auto decl = param.declaration();
+        while ( decl ) {
+            if ( decl->as<SymbolVariable>() )
+                return nullptr;
+
+            auto s = decl->as<SymbolDeclaration>();
+            if ( !s )
+                break;
+
+            decl = s->expression()->declaration();
+        }
+
+        return decl;
+    }
+
+    // Declaration a value is matched as, when it is known
+    Declaration const* valueKey(Expression const& value)
+    {
+        auto expr = &value;
+        while ( auto decl = expr->declaration() ) {
+            if ( auto e = lookThrough(decl) )
+                expr = e;
+            else if ( auto proc = decl->as<ProcedureDeclaration>() )
+                expr = proc->returnType();
+            else if ( auto var = decl->as<VariableDeclaration>() )
+                expr = var->constraint();
+            else if ( decl->as<SymbolVariable>() )
+                return nullptr;
+            else if ( decl->as<DataSumDeclaration::Constructor>() )
+                return nullptr; // matches both itself and its data sum
+            else
+                return decl;
+
+            if ( !expr )
+                return nullptr;
+        }
+
+        return nullptr;
+    }
+} // namespace
+
+SymbolSet::SymbolSet(DeclarationScope* scope, std::string_view name, lexer::intern_id_t id)
     : myScope(scope)
     , myName(name)
+    , myId(id)
 {
 }
 
 SymbolSet::SymbolSet(SymbolSet const& rhs)
     : myScope(rhs.myScope)
     , myName(rhs.myName)
+    , myId(rhs.myId)
     , mySet(rhs.mySet)
+    , myIndex(rhs.myIndex)
 {
 }
 
@@ -246,8 +316,10 @@ SymbolSet& SymbolSet::operator = (SymbolSet const& rhs)
 
 SymbolSet::SymbolSet(SymbolSet&& rhs)
     : myScope(rhs.myScope)
-    , myName(std::move(rhs.myName))
+    , myName(rhs.myName)
+    , myId(rhs.myId)
     , mySet(std::move(rhs.mySet))
+    , myIndex(std::move(rhs.myIndex))
 {
     rhs.myScope = nullptr;
 }
@@ -267,14 +339,21 @@ void SymbolSet::swap(SymbolSet& rhs)
     using std::swap;
     swap(myScope, rhs.myScope);
     swap(myName, rhs.myName);
+    swap(myId, rhs.myId);
     swap(mySet, rhs.mySet);
+    swap(myIndex, rhs.myIndex);
 }
 
-std::string const& SymbolSet::name() const
+std::string_view SymbolSet::name() const
 {
     return myName;
 }
 
+lexer::intern_id_t SymbolSet::id() const
+{
+    return myId;
+}
+
 Slice<SymbolSet::SymbolTemplate> const SymbolSet::prototypes() const
 {
     return mySet;
@@ -282,6 +361,7 @@ Slice<SymbolSet::SymbolTemplate> const SymbolSet::prototypes() const
 
 void SymbolSet::append(paramlist_t const& paramlist, Declaration& declaration)
 {
+    std::lock_guard<std::mutex> lock(myMutex);
     SymbolTemplate overload;
 
     auto const size = paramlist.size();
@@ -291,10 +371,23 @@ void SymbolSet::append(paramlist_t const& paramlist, Declaration& declaration)
 
     overload.declaration = &declaration;
     mySet.push_back(overload);
+
+    auto const index = mySet.size() - 1;
+    auto& arity = myIndex[size];
+    arity.prototypes.push_back(index);
+    arity.parameters.resize(size);
+    for ( std::size_t i = 0; i != size; ++i ) {
+        auto& param = arity.parameters[i];
+        if ( auto key = concreteKey(*paramlist[i]) )
+            param.concrete[key].push_back(index);
+        else
+            param.open.push_back(index);
+    }
 }
 
 Declaration* SymbolSet::findEquivalent(SymbolReference::paramlist_t const& paramlist)
 {
+    std::lock_guard<std::mutex> lock(myMutex);
     for ( auto const& e : mySet ) {
         if ( matchEquivalent(e.paramlist, paramlist) )
             return e.declaration;
@@ -308,24 +401,91 @@ Declaration const* SymbolSet::findEquivalent(SymbolReference::paramlist_t const&
     return const_cast<SymbolSet*>(this)->findEquivalent(paramlist);
 }
 
+/**
+ * Finds the first prototype matching paramlist, instantiating it if needed
+ *
+ * Only prototypes of the same arity are tried. For each value with a known
+ * declaration, a prototype whose parameter there requires a different
+ * declaration cannot match; the candidates are narrowed by the value that
+ * rules out the most, and tried in declaration order.
+ */
 SymbolSet::TemplateInstance
 SymbolSet::findValue(Diagnostics& dgn,
                      SymbolReference::paramlist_t const& paramlist)
 {
-    for ( auto& e : mySet ) {
-        ValueMatcher m;
-        if ( m.matchValue(e.paramlist, paramlist) ) {
-            if ( e.declaration->symbol().isConcrete() )
-                return { e.declaration, nullptr };
+    // Modules analyzed concurrently share the sets they import
+    std::unique_lock<std::mutex> lock(myMutex);
+
+    CandidateCounts counts;
+    counts.prototypes = mySet.size();
+
+    auto const arity = myIndex.find(paramlist.size());
+    if ( arity == end(myIndex) )
+        return { nullptr, nullptr, counts };
+
+    std::vector<std::size_t> const* concrete = nullptr;
+    std::vector<std::size_t> const* open = nullptr;
+    auto narrowest = arity->second.prototypes.size();
+    for ( std::size_t i = 0; i != paramlist.size(); ++i ) {
+        auto const key = valueKey(*paramlist[i]);
+        if ( !key )
+            continue;
 
-            if ( !m.rightBindings.empty() )
-                return { e.declaration, nullptr };
+        auto const& param = arity->second.parameters[i];
+        auto const c = param.concrete.find(key);
+        auto const size = param.open.size() + (c != end(param.concrete) ? c->second.size() : 0);
+        if ( size < narrowest ) {
+            narrowest = size;
+            concrete = c != end(param.concrete) ? &c->second : nullptr;
+            open = &param.open;
+        }
+    }
 
-            return instantiate(dgn, e, m.leftBindings);
+    ValueMatcher m;
+    auto const matches = [&](std::size_t i) {
+        ++counts.considered;
+        m.reset();
+        return m.matchValue(mySet[i].paramlist, paramlist);
+    };
+
+    auto found = mySet.size();
+    if ( !open ) {
+        for ( auto i : arity->second.prototypes ) {
+            if ( matches(i) ) {
+                found = i;
+                break;
+            }
+        }
+    }
+    else {
+        // Merge both lists back into declaration order
+        static std::vector<std::size_t> const none;
+        auto const& c = concrete ? *concrete : none;
+        auto ci = begin(c);
+        auto oi = begin(*open);
+        while ( ci != end(c) || oi != end(*open) ) {
+            auto const i = oi == end(*open) || (ci != end(c) && *ci < *oi) ? *ci++ : *oi++;
+            if ( matches(i) ) {
+                found = i;
+                break;
+            }
         }
     }
 
-    return { nullptr, nullptr };
+    if ( found == mySet.size() )
+        return { nullptr, nullptr, counts };
+
+    ++counts.matched;
+    auto& e = mySet[found];
+    if ( e.declaration->symbol().isConcrete() || !m.rightBindings.empty() )
+        return { e.declaration, nullptr, counts };
+
+    // Prototypes are only appended while their module is analyzed, before
+    // other modules may import it
+    lock.unlock();
+    auto ret = instantiate(dgn, e, m.leftBindings);
+    ret.candidates = counts;
+    return ret;
 }
 
 SymbolSet::TemplateInstance const
@@ -340,41 +500,103 @@ SymbolSet::instantiate(Diagnostics& dgn,
                        SymbolTemplate& proto,
                        binding_set_t const& bindingSet)
 {
+    std::lock_guard<std::recursive_mutex> lock(instantiationMutex());
+
     // use existing instantiation if it exists
-    for ( auto const& e : proto.instanceBindings ) {
+    auto const equivalent = [&bindingSet](binding_set_t const& e) {
         if ( e.size() != bindingSet.size() )
-            continue;
+            return false;
 
-        std::size_t index = 0;
-        auto l = begin(e);
         auto r = begin(bindingSet);
-        while ( l != end(e) ) {
-            if ( !matchEquivalent(*l->second, *r->second) )
-                break;
+        for ( auto const& l : e )
+            if ( !matchEquivalent(*l.second, *(r++)->second) )
+                return false;
 
-            ++l;
-            ++r;
-            ++index;
+        return true;
+    };
+
+    // Unhashed bindings may still match anything, so they are always
+    // checked; the earliest equivalent instantiation wins
+    auto const count = proto.instantiations.size();
+    auto found = count;
+    std::size_t hash = 0;
+    auto const hashed = hashEquivalent(bindingSet, hash);
+    if ( hashed ) {
+        auto const range = proto.instanceIndex.equal_range(hash);
+        for ( auto e = range.first; e != range.second; ++e )
+            if ( e->second < found && equivalent(proto.instanceBindings[e->second]) )
+                found = e->second;
+
+        for ( auto i : proto.unhashedInstances )
+            if ( i < found && equivalent(proto.instanceBindings[i]) )
+                found = i;
+    }
+    else {
+        for ( std::size_t i = 0; i < count; ++i ) {
+            if ( proto.instantiations[i] && equivalent(proto.instanceBindings[i]) ) {
+                found = i;
+                break;
+            }
         }
-
-        if ( l == end(e) )
-            return { proto.declaration, proto.instantiations[index] };
     }
 
-    // create new instantiation
-    auto instance = ast::clone(proto.declaration);
+    if ( found != count )
+        return { proto.declaration, proto.instantiations[found], CandidateCounts{} };
+
+    // create new instantiation, sized after the previous one
+    clone_map_t map(proto.cloneSize);
+    std::unique_ptr<Declaration> instance(proto.declaration->clone(map));
+    instance->remapReferences(map);
+    proto.cloneSize = map.size();
+
+    // Record the instance before resolving it, so that references to the
+    // same binding from within the instance find it. It joins the scope
+    // first too, so that whatever was resolved against it stays valid if
+    // resolving it throws.
+    if ( hashed )
+        proto.instanceIndex.emplace(hash, count);
+    else
+        proto.unhashedInstances.push_back(count);
+
+    proto.instanceBindings.push_back(bindingSet);
+    proto.instantiations.push_back(instance.get());
 
-    ScopeResolver resolver(myScope);
-    instance->symbol().bindVariables(dgn, resolver, bindingSet);
+    auto const scope = myScope;
+    TemplateInstance const ret = { proto.declaration, instance.get(), CandidateCounts{} };
+    auto& decl = *instance;
+    scope->append(std::move(instance));
 
-    if ( auto proc = instance->as<ProcedureDeclaration>() )
-        proc->resolvePrototypeSymbols(dgn);
+    try {
+        ScopeResolver resolver(scope);
+        decl.symbol().bindVariables(dgn, resolver, bindingSet);
 
-    instance->resolveSymbols(dgn);
+        if ( auto proc = decl.as<ProcedureDeclaration>() )
+            proc->resolvePrototypeSymbols(dgn);
 
-    proto.instantiations.push_back(instance.get());
-    myScope->append(std::move(instance));
-    return { proto.declaration, proto.instantiations.back() };
+        decl.resolveSymbols(dgn);
+    }
+    catch (...) {
+        // Later lookups instantiate afresh instead of finding the partly
+        // resolved instance
+        if ( hashed ) {
+            auto const range = proto.instanceIndex.equal_range(hash);
+            for ( auto e = range.first; e != range.second; ++e ) {
+                if ( e->second == count ) {
+                    proto.instanceIndex.erase(e);
+                    break;
+                }
+            }
+        }
+        else {
+            auto& unhashed = proto.unhashedInstances;
+            unhashed.erase(std::remove(begin(unhashed), end(unhashed), count), end(unhashed));
+        }
+
+        proto.instantiations[count] = nullptr;
+        throw;
+    }
+
+    return ret;
 }
 
     } // namespace ast
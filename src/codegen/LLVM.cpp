@@ -1,6 +1,7 @@
 #include <kyfoo/codegen/LLVM.hpp>
 
 #include <experimental/filesystem>
+#include <unordered_map>
 
 #pragma warning(push, 0)
 #include <llvm/ADT/APFloat.h>
@@ -34,6 +35,7 @@
 #include <kyfoo/ast/Declarations.hpp>
 #include <kyfoo/ast/Expressions.hpp>
 #include <kyfoo/ast/Module.hpp>
+#include <kyfoo/ast/Passes.hpp>
 #include <kyfoo/ast/Scopes.hpp>
 #include <kyfoo/ast/Semantics.hpp>
 
@@ -72,6 +74,11 @@ struct LLVMCustomData<ast::DataProductDeclaration> : public CustomData
     llvm::Type* type = nullptr;
 };
 
+inline llvm::StringRef toStringRef(std::string_view s)
+{
+    return llvm::StringRef(s.data(), s.size());
+}
+
 template <typename T>
 LLVMCustomData<T>* customData(T const& decl)
 {
@@ -105,15 +112,38 @@ llvm::Type* toType(ast::Expression const& expr)
     if ( !decl )
         return nullptr;
 
+    // Declarations are initialized as they are walked, so may not be yet
     if ( auto ds = decl->as<ast::DataSumDeclaration>() )
-        return customData(*ds)->type;
+        if ( auto data = customData(*ds) )
+            return data->type;
 
     if ( auto dp = decl->as<ast::DataProductDeclaration>() )
-        return customData(*dp)->type;
+        if ( auto data = customData(*dp) )
+            return data->type;
 
     return nullptr;
 }
 
+// Lowered types keyed by canonical type expression
+using type_cache_t = std::unordered_map<ast::Expression const*, llvm::Type*>;
+
+llvm::Type* toType(type_cache_t& cache, ast::Expression const& expr)
+{
+    auto const key = expr.canonical();
+    if ( !key )
+        return toType(expr);
+
+    auto e = cache.find(key);
+    if ( e != end(cache) )
+        return e->second;
+
+    auto type = toType(expr);
+    if ( type )
+        cache[key] = type;
+
+    return type;
+}
+
 //
 // InitCodeGenPass
 
@@ -212,15 +242,18 @@ struct CodeGenPass
     Diagnostics& dgn;
     llvm::Module* module;
     ast::Module* sourceModule;
+    type_cache_t& types;
 
     CodeGenPass(Dispatcher& dispatch,
                 Diagnostics& dgn,
                 llvm::Module* module,
-                ast::Module* sourceModule)
+                ast::Module* sourceModule,
+                type_cache_t& types)
         : dispatch(dispatch)
         , dgn(dgn)
         , module(module)
         , sourceModule(sourceModule)
+        , types(types)
     {
     }
 
@@ -258,11 +291,11 @@ struct CodeGenPass
         if ( fun->proto )
             return;
 
-        auto returnType = toType(*decl.returnType());
+        auto returnType = toType(types, *decl.returnType());
         std::vector<llvm::Type*> params;
         params.reserve(decl.parameters().size());
         for ( auto const& p : decl.parameters() )
-            params.push_back(toType(*p->constraint()));
+            params.push_back(toType(types, *p->constraint()));
 
         fun->proto = llvm::FunctionType::get(returnType, params, /*isVarArg*/false);
 
@@ -271,7 +304,7 @@ struct CodeGenPass
 
         fun->body = llvm::Function::Create(fun->proto,
                                            llvm::Function::ExternalLinkage, // todo
-                                           decl.symbol().name(),
+                                           toStringRef(decl.symbol().name()),
                                            module);
 
         {
@@ -367,17 +400,18 @@ private:
             case lexer::TokenKind::Integer:
                 // todo
                 return llvm::ConstantInt::get(llvm::Type::getInt32Ty(builder.getContext()),
-                                              p->token().lexeme(), 10);
+                                              toStringRef(p->token().lexeme()), 10);
 
             case lexer::TokenKind::Decimal:
                 // todo
                 return llvm::ConstantFP::get(llvm::Type::getDoubleTy(builder.getContext()),
-                                             p->token().lexeme());
+                                             toStringRef(p->token().lexeme()));
 
             case lexer::TokenKind::String:
                 // todo
-                return llvm::ConstantDataArray::get(builder.getContext(),
-                                                    llvm::ArrayRef<std::uint8_t>(reinterpret_cast<std::uint8_t const*>(p->token().lexeme().c_str()), p->token().lexeme().size() + 1));
+                return llvm::ConstantDataArray::getString(builder.getContext(),
+                                                          toStringRef(p->token().lexeme()),
+                                                          /*AddNull*/true);
             }
 
             return nullptr;
@@ -447,6 +481,8 @@ struct LLVMGenerator::LLVMState
 
     std::unique_ptr<llvm::LLVMContext> context;
     std::unique_ptr<llvm::Module> module;
+    type_cache_t types;
+    ast::ShallowApply<InitCodeGenPass> init;
 
     LLVMState(Diagnostics& dgn,
               ast::Module& sourceModule)
@@ -490,24 +526,26 @@ struct LLVMGenerator::LLVMState
 
     void generate()
     {
-        ast::ShallowApply<InitCodeGenPass> init;
-        for ( auto d : sourceModule.scope()->childDeclarations() )
-            init(*d);
+        ast::ShallowApply<CodeGenPass> gen(dgn, module.get(), &sourceModule, types);
 
-        for ( auto d : sourceModule.templateInstantiations() )
-            init(*d);
+        // Initialization and type registration share one walk; registerType
+        // initializes declarations the walk has not reached yet
+        ast::PassManager passes;
+        auto initPass = passes.add([this](ast::Declaration const& d) { init(d); });
+        auto typesPass = passes.add([this](ast::Declaration const& d) { registerTypes(d); },
+                                    ast::PassManager::Declarations);
+        auto instanceTypesPass = passes.add([this](ast::Declaration const& d) {
+            if ( d.symbol().isConcrete() )
+                registerType(*resolveIndirections(&d));
+        }, ast::PassManager::Instances);
+        auto genPass = passes.add([&gen](ast::Declaration const& d) { gen(d); },
+                                  ast::PassManager::Declarations);
 
-        registerTypes(*sourceModule.scope());
-        for ( auto d : sourceModule.templateInstantiations() ) {
-            if ( d->symbol().isConcrete() ) {
-                auto decl = resolveIndirections(d);
-                registerType(*decl);
-            }
-        }
-
-        ast::ShallowApply<CodeGenPass> gen(dgn, module.get(), &sourceModule);
-        for ( auto d : sourceModule.scope()->childDeclarations() )
-            gen(*d);
+        passes.depend(typesPass, initPass, ast::PassDependency::Node);
+        passes.depend(instanceTypesPass, initPass, ast::PassDependency::Node);
+        passes.depend(genPass, typesPass, ast::PassDependency::Module);
+        passes.depend(genPass, instanceTypesPass, ast::PassDependency::Module);
+        passes.run(sourceModule);
     }
 
     llvm::Type* intrinsicType(ast::Declaration const& decl)
@@ -527,7 +565,7 @@ struct LLVMGenerator::LLVMState
                 if ( sym.parameters().size() == 1 ) {
                     if ( auto p = resolveIndirections(sym.parameters()[0].get())->as<ast::PrimaryExpression>() ) {
                         if ( p->token().kind() == lexer::TokenKind::Integer ) {
-                            int n = std::atoi(p->token().lexeme().c_str());
+                            int n = std::atoi(std::string(p->token().lexeme()).c_str());
                             if ( n <= 0 ) {
                                 error(*p) << "cannot instantiate integer with size " << n;
                                 die();
@@ -541,7 +579,7 @@ struct LLVMGenerator::LLVMState
             }
             else if ( sym.name() == "pointer" ) {
                 if ( sym.parameters().size() == 1 ) {
-                    auto t = toType(*sym.parameters()[0]);
+                    auto t = toType(types, *sym.parameters()[0]);
                     dsData->type = llvm::PointerType::get(t, 0);
                     return dsData->type;
                 }
@@ -557,6 +595,9 @@ struct LLVMGenerator::LLVMState
 
     llvm::Type* registerType(ast::Declaration const& decl)
     {
+        if ( !decl.codegenData() )
+            init(decl);
+
         if ( auto t = intrinsicType(decl) )
             return t;
 
@@ -598,7 +639,7 @@ struct LLVMGenerator::LLVMState
 
             dpData->type = llvm::StructType::create(*context,
                                                     fieldTypes,
-                                                    dp->symbol().name(),
+                                                    toStringRef(dp->symbol().name()),
                                                     /*isPacked*/false);
             return dpData->type;
         }
@@ -606,28 +647,32 @@ struct LLVMGenerator::LLVMState
         return nullptr;
     }
 
-    void registerTypes(ast::DeclarationScope const& scope)
+    void registerTypes(ast::Declaration const& decl)
     {
-        for ( auto const& decl : scope.childDeclarations() ) {
-            if ( !decl->symbol().isConcrete() )
-                continue;
+        if ( !decl.symbol().isConcrete() )
+            return;
 
-            auto d = resolveIndirections(decl);
-            registerType(*d);
+        auto d = resolveIndirections(&decl);
+        registerType(*d);
 
-            if ( auto ds = d->as<ast::DataSumDeclaration>() ) {
-                if ( auto defn = ds->definition() )
-                    registerTypes(*defn);
-            }
-            else if ( auto dp = d->as<ast::DataProductDeclaration>() ) {
-                if ( auto defn = dp->definition() )
-                    registerTypes(*defn);
-            }
-            else if ( auto proc = d->as<ast::ProcedureDeclaration>() ) {
-                if ( auto defn = proc->definition() )
-                    registerTypes(*defn);
-            }
+        if ( auto ds = d->as<ast::DataSumDeclaration>() ) {
+            if ( auto defn = ds->definition() )
+                registerTypes(*defn);
         }
+        else if ( auto dp = d->as<ast::DataProductDeclaration>() ) {
+            if ( auto defn = dp->definition() )
+                registerTypes(*defn);
+        }
+        else if ( auto proc = d->as<ast::ProcedureDeclaration>() ) {
+            if ( auto defn = proc->definition() )
+                registerTypes(*defn);
+        }
+    }
+
+    void registerTypes(ast::DeclarationScope const& scope)
+    {
+        for ( auto const& decl : scope.childDeclarations() )
+            registerTypes(*decl);
     }
 };
 
@@ -0,0 +1,362 @@
+#include <kyfoo/lexer/CharScan.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#   define KYFOO_CHARSCAN_X86 1
+#   include <immintrin.h>
+#   if defined(_MSC_VER)
+#       include <intrin.h>
+#   endif
+#endif
+
+// MSVC exposes every intrinsic regardless of /arch, gcc and clang need
+// the target enabled per function
+#if defined(__GNUC__) || defined(__clang__)
+#   define KYFOO_TARGET(t) __attribute__((target(t)))
+#else
+#   define KYFOO_TARGET(t)
+#endif
+
+namespace kyfoo {
+    namespace lexer {
+
+namespace
+{
+    struct CharScanTable
+    {
+        CharScanIsa isa;
+        char const* (*skipIdentifierMid)(char const*, char const*);
+        char const* (*skipSpaces)(char const*, char const*);
+        char const* (*findLineBreak)(char const*, char const*);
+        std::size_t (*countNewlines)(char const*, char const*);
+    };
+
+    //
+    // Scalar
+
+    char const* scalarSkipIdentifierMid(char const* first, char const* last)
+    {
+        while ( first != last && isIdentifierMid(*first) )
+            ++first;
+
+        return first;
+    }
+
+    char const* scalarSkipSpaces(char const* first, char const* last)
+    {
+        while ( first != last && isSpace(*first) )
+            ++first;
+
+        return first;
+    }
+
+    char const* scalarFindLineBreak(char const* first, char const* last)
+    {
+        while ( first != last && !isLineBreak(*first) )
+            ++first;
+
+        return first;
+    }
+
+    std::size_t scalarCountNewlines(char const* first, char const* last)
+    {
+        return std::count(first, last, '\n');
+    }
+
+    CharScanTable const theScalarTable = {
+        CharScanIsa::Scalar,
+        scalarSkipIdentifierMid,
+        scalarSkipSpaces,
+        scalarFindLineBreak,
+        scalarCountNewlines,
+    };
+
+#ifdef KYFOO_CHARSCAN_X86
+    unsigned countTrailingZeros(unsigned mask)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return index;
+#else
+        return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+    }
+
+    //
+    // SSE2
+
+    KYFOO_TARGET("sse2")
+    inline __m128i inRange128(__m128i v, char lo, char hi)
+    {
+        // Signed compares, so bytes >= 0x80 never match
+        return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+                             _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+    }
+
+    KYFOO_TARGET("sse2")
+    inline __m128i identifierMid128(__m128i v)
+    {
+        auto const folded = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        auto m = inRange128(folded, 'a', 'z');
+        m = _mm_or_si128(m, inRange128(v, '0', '9'));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+        return _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('-')));
+    }
+
+    KYFOO_TARGET("sse2")
+    char const* sse2SkipIdentifierMid(char const* first, char const* last)
+    {
+        for ( ; last - first >= 16; first += 16 ) {
+            auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(first));
+            auto const miss = ~unsigned(_mm_movemask_epi8(identifierMid128(v))) & 0xffffu;
+            if ( miss )
+                return first + countTrailingZeros(miss);
+        }
+
+        return scalarSkipIdentifierMid(first, last);
+    }
+
+    KYFOO_TARGET("sse2")
+    char const* sse2SkipSpaces(char const* first, char const* last)
+    {
+        for ( ; last - first >= 16; first += 16 ) {
+            auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(first));
+            auto const m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                        _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+            auto const miss = ~unsigned(_mm_movemask_epi8(m)) & 0xffffu;
+            if ( miss )
+                return first + countTrailingZeros(miss);
+        }
+
+        return scalarSkipSpaces(first, last);
+    }
+
+    KYFOO_TARGET("sse2")
+    char const* sse2FindLineBreak(char const* first, char const* last)
+    {
+        for ( ; last - first >= 16; first += 16 ) {
+            auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(first));
+            auto const m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')),
+                                        _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+            auto const hit = unsigned(_mm_movemask_epi8(m));
+            if ( hit )
+                return first + countTrailingZeros(hit);
+        }
+
+        return scalarFindLineBreak(first, last);
+    }
+
+    KYFOO_TARGET("sse2")
+    std::size_t sse2CountNewlines(char const* first, char const* last)
+    {
+        std::size_t ret = 0;
+        for ( ; last - first >= 16; first += 16 ) {
+            auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(first));
+            auto const hit = unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))));
+            ret += std::bitset<16>(hit).count();
+        }
+
+        return ret + scalarCountNewlines(first, last);
+    }
+
+    CharScanTable const theSse2Table = {
+        CharScanIsa::SSE2,
+        sse2SkipIdentifierMid,
+        sse2SkipSpaces,
+        sse2FindLineBreak,
+        sse2CountNewlines,
+    };
+
+    //
+    // AVX2
+
+    KYFOO_TARGET("avx2")
+    inline __m256i inRange256(__m256i v, char lo, char hi)
+    {
+        return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)),
+                                _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v));
+    }
+
+    KYFOO_TARGET("avx2")
+    inline __m256i identifierMid256(__m256i v)
+    {
+        auto const folded = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        auto m = inRange256(folded, 'a', 'z');
+        m = _mm256_or_si256(m, inRange256(v, '0', '9'));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+        return _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('-')));
+    }
+
+    KYFOO_TARGET("avx2")
+    char const* avx2SkipIdentifierMid(char const* first, char const* last)
+    {
+        for ( ; last - first >= 32; first += 32 ) {
+            auto const v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(first));
+            auto const miss = ~unsigned(_mm256_movemask_epi8(identifierMid256(v)));
+            if ( miss )
+                return first + countTrailingZeros(miss);
+        }
+
+        return sse2SkipIdentifierMid(first, last);
+    }
+
+    KYFOO_TARGET("avx2")
+    char const* avx2SkipSpaces(char const* first, char const* last)
+    {
+        for ( ; last - first >= 32; first += 32 ) {
+            auto const v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(first));
+            auto const m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                                           _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+            auto const miss = ~unsigned(_mm256_movemask_epi8(m));
+            if ( miss )
+                return first + countTrailingZeros(miss);
+        }
+
+        return sse2SkipSpaces(first, last);
+    }
+
+    KYFOO_TARGET("avx2")
+    char const* avx2FindLineBreak(char const* first, char const* last)
+    {
+        for ( ; last - first >= 32; first += 32 ) {
+            auto const v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(first));
+            auto const m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')),
+                                           _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+            auto const hit = unsigned(_mm256_movemask_epi8(m));
+            if ( hit )
+                return first + countTrailingZeros(hit);
+        }
+
+        return sse2FindLineBreak(first, last);
+    }
+
+    KYFOO_TARGET("avx2")
+    std::size_t avx2CountNewlines(char const* first, char const* last)
+    {
+        std::size_t ret = 0;
+        for ( ; last - first >= 32; first += 32 ) {
+            auto const v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(first));
+            auto const hit = unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))));
+            ret += std::bitset<32>(hit).count();
+        }
+
+        return ret + sse2CountNewlines(first, last);
+    }
+
+    CharScanTable const theAvx2Table = {
+        CharScanIsa::AVX2,
+        avx2SkipIdentifierMid,
+        avx2SkipSpaces,
+        avx2FindLineBreak,
+        avx2CountNewlines,
+    };
+#endif
+
+    CharScanTable const* tableFor(CharScanIsa isa)
+    {
+        switch (isa) {
+#ifdef KYFOO_CHARSCAN_X86
+        case CharScanIsa::AVX2: return &theAvx2Table;
+        case CharScanIsa::SSE2: return &theSse2Table;
+#endif
+        default: return &theScalarTable;
+        }
+    }
+
+    std::atomic<CharScanTable const*> theTable{ nullptr };
+
+    CharScanTable const& table()
+    {
+        auto t = theTable.load(std::memory_order_acquire);
+        if ( !t ) {
+            t = tableFor(detectCharScanIsa());
+            theTable.store(t, std::memory_order_release);
+        }
+
+        return *t;
+    }
+} // namespace
+
+const char* to_string(CharScanIsa isa)
+{
+    switch (isa) {
+    case CharScanIsa::Scalar: return "scalar";
+    case CharScanIsa::SSE2: return "sse2";
+    case CharScanIsa::AVX2: return "avx2";
+    }
+
+    return "unknown";
+}
+
+CharScanIsa detectCharScanIsa()
+{
+#ifdef KYFOO_CHARSCAN_X86
+#   if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    auto const maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    bool const sse2 = (info[3] & (1 << 26)) != 0;
+    bool const osxsave = (info[2] & (1 << 27)) != 0;
+    bool const avx = (info[2] & (1 << 28)) != 0;
+
+    // AVX2 also needs the OS to preserve the ymm registers
+    if ( maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6 ) {
+        __cpuidex(info, 7, 0);
+        if ( info[1] & (1 << 5) )
+            return CharScanIsa::AVX2;
+    }
+
+    if ( sse2 )
+        return CharScanIsa::SSE2;
+#   else
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports("avx2") )
+        return CharScanIsa::AVX2;
+
+    if ( __builtin_cpu_supports("sse2") )
+        return CharScanIsa::SSE2;
+#   endif
+#endif
+
+    return CharScanIsa::Scalar;
+}
+
+CharScanIsa charScanIsa()
+{
+    return table().isa;
+}
+
+void setCharScanIsa(CharScanIsa isa)
+{
+    isa = std::min(isa, detectCharScanIsa());
+    theTable.store(tableFor(isa), std::memory_order_release);
+}
+
+char const* skipIdentifierMid(char const* first, char const* last)
+{
+    return table().skipIdentifierMid(first, last);
+}
+
+char const* skipSpaces(char const* first, char const* last)
+{
+    return table().skipSpaces(first, last);
+}
+
+char const* findLineBreak(char const* first, char const* last)
+{
+    return table().findLineBreak(first, last);
+}
+
+std::size_t countNewlines(char const* first, char const* last)
+{
+    return table().countNewlines(first, last);
+}
+
+    } // namespace lexer
+} // namespace kyfoo
@@ -0,0 +1,68 @@
+#include <kyfoo/lexer/InternTable.hpp>
+
+#include <stdexcept>
+
+namespace kyfoo {
+    namespace lexer {
+
+InternTable::InternTable()
+{
+    myTexts.push_back(std::string_view());
+    myIds.emplace(std::string_view(), invalid_intern_id);
+}
+
+InternTable::~InternTable() = default;
+
+intern_id_t InternTable::intern(std::string_view text)
+{
+    // Nearly every identifier has been seen before
+    {
+        std::shared_lock<std::shared_mutex> lock(myMutex);
+        auto e = myIds.find(text);
+        if ( e != end(myIds) )
+            return e->second;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(myMutex);
+    auto e = myIds.find(text);
+    if ( e != end(myIds) )
+        return e->second;
+
+    // Keep a private copy so ids outlive the buffers they were scanned from
+    myStrings.emplace_back(text);
+    std::string_view key = myStrings.back();
+
+    auto const id = static_cast<intern_id_t>(myTexts.size());
+    myTexts.push_back(key);
+    myIds.emplace(key, id);
+
+    return id;
+}
+
+intern_id_t InternTable::find(std::string_view text) const
+{
+    std::shared_lock<std::shared_mutex> lock(myMutex);
+    auto e = myIds.find(text);
+    if ( e != end(myIds) )
+        return e->second;
+
+    return invalid_intern_id;
+}
+
+std::string_view InternTable::text(intern_id_t id) const
+{
+    std::shared_lock<std::shared_mutex> lock(myMutex);
+    if ( id >= myTexts.size() )
+        throw std::out_of_range("invalid intern id");
+
+    return myTexts[id];
+}
+
+std::size_t InternTable::size() const
+{
+    std::shared_lock<std::shared_mutex> lock(myMutex);
+    return myTexts.size();
+}
+
+    } // namespace lexer
+} // namespace kyfoo
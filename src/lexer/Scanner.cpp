@@ -1,136 +1,145 @@
 #include <kyfoo/lexer/Scanner.hpp>
 
+#include <algorithm>
 #include <cassert>
 #include <cctype>
 
-#include <map>
+#include <kyfoo/lexer/CharScan.hpp>
 
 namespace kyfoo {
     namespace lexer {
 
 namespace
 {
-    bool isSpace(char c)
-    {
-        switch (c)
-        {
-        case ' ':
-        case '\t':
-            return true;
-        }
-
-        return false;
-    }
-
     bool isLineComment(char c)
     {
         return c == ';';
     }
 
-    bool isLineBreak(char c)
-    {
-        switch (c)
-        {
-        case '\r':
-        case '\n':
-            return true;
-        }
-
-        return false;
-    }
-
-    bool isLetter(char c)
-    {
-        if ( 'a' <= c && c <= 'z' )
-            return true;
-
-        if ( 'A' <= c && c <= 'Z' )
-            return true;
-
-        return false;
-    }
-
-    bool isNumber(char c)
+    bool isIdentifierStart(char c)
     {
-        if ( '0' <= c && c <= '9' )
-            return true;
-
-        return false;
+        return isLetter(c);
     }
 
-    bool isIdentifierStart(char c)
+    bool isFreeVariable(char c)
     {
-        return isLetter(c);
+        return c == '\\';
     }
 
-    bool isIdentifierMid(char c)
+    constexpr TokenKind identifierKind(std::string_view lexeme)
     {
-        if ( isLetter(c) || isNumber(c) )
-            return true;
+        // Keyword lengths are all distinct except for type/else
+        switch ( lexeme.size() ) {
+        case 2:
+            if ( lexeme == "if" )
+                return TokenKind::_if;
+            break;
+
+        case 3:
+            if ( lexeme == "var" )
+                return TokenKind::_var;
+            break;
+
+        case 4:
+            switch ( lexeme[0] ) {
+            case 't': if ( lexeme == "type" ) return TokenKind::_type; break;
+            case 'e': if ( lexeme == "else" ) return TokenKind::_else; break;
+            }
+            break;
 
-        switch (c) {
-        case '_': return true;
-        case '-': return true;
+        case 6:
+            if ( lexeme == "import" )
+                return TokenKind::_import;
+            break;
         }
 
-        return false;
+        return TokenKind::Identifier;
     }
 
-    bool isFreeVariable(char c)
+    constexpr bool classifies(TokenKind kind, std::string_view spelling)
     {
-        return c == '\\';
+        return kind <= TokenKind::_keywordStart
+            || kind >= TokenKind::_keywordEnd
+            || identifierKind(spelling) == kind;
     }
 
-    TokenKind identifierKind(std::string const& lexeme)
-    {
-        static std::map<std::string, TokenKind> map;
-        static struct _init_map { _init_map(std::map<std::string, TokenKind>& map) {
-            for ( int i = (int)TokenKind::_keywordStart + 1; i != (int)TokenKind::_keywordEnd; ++i )
-                map[to_string((TokenKind)i)] = (TokenKind)i;
-        } } init_map(map);
-
-        auto e = map.find(lexeme);
-        if ( e != map.end() )
-            return e->second;
-        
-        return TokenKind::Identifier;
-    }
+    // Each keyword in TOKEN_DEFINITIONS must be recognized by identifierKind
+#define X(A,B) static_assert(classifies(TokenKind::A, B), "identifierKind does not recognize keyword '" B "'");
+    TOKEN_DEFINITIONS(X)
+#undef X
 }
 
-Scanner::Scanner(std::istream& stream)
-    : myStream(stream)
-    , myState(InternalScanState{ 0 })
+Scanner::Scanner(SourceBuffer const& source, InternTable& interns, ScanMode mode)
+    : Scanner(source, interns, mode, 0, static_cast<source_offset_t>(source.size()))
 {
+}
+
+Scanner::Scanner(SourceBuffer const& source,
+                 InternTable& interns,
+                 ScanMode mode,
+                 source_offset_t first,
+                 source_offset_t last)
+    : mySource(source)
+    , myInterns(interns)
+    , myCursor(source.begin() + first)
+    , myEnd(source.begin() + last)
+    , myLineStart(source.begin() + first)
+    , myMode(mode)
+{
+    if ( myMode == ScanMode::Tokenized )
+        tokenize();
+
     if ( peek().kind() == TokenKind::IndentEQ )
         next();
 }
 
 Token Scanner::next()
 {
-    if ( !mySavePoints.empty() ) {
-        if ( myState.readIndex + 1 >= myBuffer.size() )
-            peek(myState.readIndex + 1);
+    if ( myMode == ScanMode::Tokenized ) {
+        auto const index = myReadIndex;
+        if ( index + 1 != myTokens.size() )
+            ++myReadIndex;
+
+        reach(index);
+        return myTokens[index];
     }
 
-    if ( !myBuffer.empty() ) {
-        auto ret = myBuffer[myState.readIndex];
-        if ( mySavePoints.empty() ) {
-            assert(myState.readIndex == 0);
+    // Tokens read inside a scan must stay buffered for rollback
+    if ( myScanDepth && myReadIndex >= myBuffer.size() )
+        peek();
+
+    if ( myReadIndex < myBuffer.size() ) {
+        auto ret = myBuffer[myReadIndex];
+        if ( !myScanDepth ) {
+            assert(myReadIndex == 0);
             myBuffer.pop_front();
+            ++myConsumed;
         }
         else {
-            ++myState.readIndex;
+            ++myReadIndex;
         }
 
         return ret;
     }
 
-    return readNext();
+    // EndOfFile is never buffered and, as in tokenized mode, does not advance
+    // the position
+    auto ret = readNext();
+    if ( ret.kind() != TokenKind::EndOfFile )
+        ++myConsumed;
+
+    return ret;
 }
 
 Token Scanner::peek(std::size_t lookAhead)
 {
-    auto const peekTarget = myState.readIndex + lookAhead;
+    auto const peekTarget = myReadIndex + lookAhead;
+    if ( myMode == ScanMode::Tokenized ) {
+        auto const index = std::min(peekTarget, myTokens.size() - 1);
+        reach(index);
+        return myTokens[index];
+    }
+
     if ( peekTarget < myBuffer.size() )
         return myBuffer[peekTarget];
     
@@ -145,83 +154,235 @@ Token Scanner::peek(std::size_t lookAhead)
     return myBuffer[peekTarget];
 }
 
-void Scanner::beginScan()
+std::size_t Scanner::beginScan()
 {
-    mySavePoints.push_back(myState);
+    if ( !myScanDepth && myMemo.empty() )
+        myCaptures.reset();
+
+    ++myScanDepth;
+    return myReadIndex;
 }
 
 void Scanner::endScan()
 {
-    mySavePoints.pop_back();
+    --myScanDepth;
 
-    if ( mySavePoints.empty() ) {
-        myBuffer.erase(begin(myBuffer), begin(myBuffer) + myState.readIndex);
-        myState.readIndex = 0;
+    if ( myScanDepth )
+        return;
+
+    myMemo.clear();
+    if ( myMode == ScanMode::Stream ) {
+        myBuffer.erase(begin(myBuffer), begin(myBuffer) + myReadIndex);
+        myConsumed += myReadIndex;
+        myReadIndex = 0;
     }
 }
 
-void Scanner::rollbackScan()
+void Scanner::rollbackScan(std::size_t savePoint)
 {
-    myState = mySavePoints.back();
-    mySavePoints.pop_back();
+    myReadIndex = savePoint;
+    --myScanDepth;
 }
 
 bool Scanner::eof() const
 {
-    return myStream.eof() && myBuffer.empty();
+    // Streaming hits eof once the source is exhausted and every token read
+    // from it has been consumed
+    if ( myMode == ScanMode::Tokenized )
+        return myEndIndex <= myReachIndex
+            && std::min(myReachIndex + 1, myTokens.size() - 1) <= myReadIndex;
+
+    return atEnd() && myBuffer.empty();
 }
 
 bool Scanner::hasError() const
 {
+    if ( myMode == ScanMode::Tokenized )
+        return myErrorIndex <= myReachIndex;
+
     return myError;
 }
 
 Scanner::operator bool() const
 {
-    return !eof() && !myError;
+    return !eof() && !hasError();
+}
+
+ScanMode Scanner::mode() const
+{
+    return myMode;
+}
+
+std::vector<Token> const& Scanner::tokens() const
+{
+    return myTokens;
+}
+
+std::size_t Scanner::position() const
+{
+    return myConsumed + myReadIndex;
+}
+
+void Scanner::skip(std::size_t count)
+{
+    if ( !count )
+        return;
+
+    if ( myMode == ScanMode::Tokenized ) {
+        auto const last = std::min(myReadIndex + count, myTokens.size()) - 1;
+        myReadIndex = std::min(myReadIndex + count, myTokens.size() - 1);
+        reach(last);
+        return;
+    }
+
+    while ( count-- )
+        next();
+}
+
+void Scanner::memoize(bool enable)
+{
+    myMemoize = enable;
+    if ( !enable )
+        myMemo.clear();
+}
+
+ScanMemo const* Scanner::recall(void const* production) const
+{
+    if ( !myMemoize )
+        return nullptr;
+
+    auto e = myMemo.find(std::make_pair(production, position()));
+    if ( e == end(myMemo) )
+        return nullptr;
+
+    return &e->second;
+}
+
+void Scanner::remember(void const* production, std::size_t position, ScanMemo memo)
+{
+    if ( myMemoize )
+        myMemo[std::make_pair(production, position)] = memo;
+}
+
+Arena& Scanner::captures()
+{
+    return myCaptures;
+}
+
+void Scanner::release(Arena::Mark const& mark)
+{
+    if ( !myMemoize )
+        myCaptures.rewind(mark);
+}
+
+void Scanner::tokenize()
+{
+    // Roughly one token per four bytes of source
+    myTokens.reserve(mySource.size() / 4 + 1);
+
+    for (;;) {
+        auto const cursor = myCursor;
+        auto tok = readNext();
+        if ( tok.kind() == TokenKind::EndOfFile )
+            break;
+
+        // Dedents beyond the first are queued by indent()
+        auto const first = myTokens.size();
+        for ( auto const& queued : myBuffer )
+            myTokens.push_back(queued);
+        myBuffer.clear();
+
+        myTokens.push_back(tok);
+        if ( atEnd() && myEndIndex == npos )
+            myEndIndex = first;
+
+        if ( myError && myErrorIndex == npos )
+            myErrorIndex = first;
+
+        // An unrecognized character is never consumed, so the stream would
+        // repeat this token forever; peeks past the end of the array do
+        if ( myCursor == cursor )
+            return;
+    }
+
+    if ( myEndIndex == npos )
+        myEndIndex = myTokens.size();
+
+    myTokens.push_back(token(TokenKind::EndOfFile, myCursor, myCursor));
+}
+
+void Scanner::reach(std::size_t index)
+{
+    if ( index > myReachIndex )
+        myReachIndex = index;
 }
 
 char Scanner::nextChar()
 {
-    ++myColumn;
-    return static_cast<char>(myStream.get());
+    if ( atEnd() )
+        return '\0';
+
+    return *myCursor++;
+}
+
+char Scanner::peekChar() const
+{
+    if ( atEnd() )
+        return '\0';
+
+    return *myCursor;
+}
+
+void Scanner::ungetChar()
+{
+    --myCursor;
+}
+
+bool Scanner::atEnd() const
+{
+    return myCursor == myEnd;
 }
 
-char Scanner::peekChar()
+Token Scanner::token(TokenKind kind, char const* first, char const* last, intern_id_t id) const
 {
-    return static_cast<char>(myStream.peek());
+    return Token(kind,
+                 mySource.id(),
+                 mySource.generation(),
+                 static_cast<source_offset_t>(first - mySource.begin()),
+                 static_cast<source_offset_t>(last - first),
+                 id);
 }
 
-Token Scanner::indent(line_index_t line, column_index_t column, indent_width_t indent)
+Token Scanner::indent(indent_width_t indent)
 {
     indent_width_t current = 0;
     if ( !myIndents.empty() )
         current = myIndents.back();
 
     if ( indent == current )
-        return Token(TokenKind::IndentEQ, line, column, "");
+        return token(TokenKind::IndentEQ, myCursor, myCursor);
 
     if ( indent > current ) {
         myIndents.push_back(indent);
-        return Token(TokenKind::IndentGT, line, column, "");
+        return token(TokenKind::IndentGT, myCursor, myCursor);
     }
 
-    Token ret(TokenKind::IndentLT, line, column, "");
+    auto ret = token(TokenKind::IndentLT, myCursor, myCursor);
     myIndents.pop_back();
 
     while ( !myIndents.empty() && myIndents.back() != indent ) {
         if ( myIndents.back() < indent ) {
             myError = true;
-            return Token(TokenKind::IndentError, line, column, "");
+            return token(TokenKind::IndentError, myCursor, myCursor);
         }
         
-        myBuffer.push_back(Token(TokenKind::IndentLT, line, column, ""));
+        myBuffer.push_back(token(TokenKind::IndentLT, myCursor, myCursor));
         myIndents.pop_back();
     }
 
     if ( myIndents.empty() && indent != 0 ) {
         myError = true;
-        return Token(TokenKind::IndentError, line, column, "");
+        return token(TokenKind::IndentError, myCursor, myCursor);
     }
 
     return ret;
@@ -229,35 +390,29 @@ Token Scanner::indent(line_index_t line, column_index_t column, indent_width_t i
 
 void Scanner::bumpLine()
 {
-    ++myLine;
-    myColumn = 1;
+    myLineStart = myCursor;
 }
 
 Token Scanner::readNext()
 {
-#define TOK(t) Token(TokenKind::##t, myLine, column, lexeme)
-#define TOK2(t, l) Token(TokenKind::##t, myLine, column, l)
+#define TOK(t) token(TokenKind::##t, lexeme, myCursor)
 
     char c = peekChar();
-    std::string lexeme;
-    column_index_t column = myColumn;
+    char const* lexeme = myCursor;
+    bool const lineStart = myCursor == myLineStart;
 
-    if ( myStream.eof() )
+    if ( atEnd() )
         return TOK(EndOfFile);
 
     auto takeSpaces = [this, &c] {
-        indent_width_t spaces = 0;
-        while ( isSpace(c) ) {
-            ++spaces;
-            nextChar();
-            c = peekChar();
-        }
+        auto const first = myCursor;
+        myCursor = skipSpaces(myCursor, myEnd);
+        auto const spaces = static_cast<indent_width_t>(myCursor - first);
+        c = peekChar();
 
         if ( isLineComment(c) ) {
-            do {
-                nextChar();
-                c = peekChar();
-            } while ( !isLineBreak(c) );
+            myCursor = findLineBreak(myCursor, myEnd);
+            c = peekChar();
         }
 
         return spaces;
@@ -266,10 +421,10 @@ Token Scanner::readNext()
     auto takeLineBreaks = [this, &c] {
         int ret = 0;
         while ( isLineBreak(c) ) {
+            nextChar();
             if ( c == '\r' && peekChar() == '\n' )
                 nextChar();
 
-            nextChar();
             bumpLine();
             ++ret;
             c = peekChar();
@@ -281,8 +436,10 @@ Token Scanner::readNext()
     auto spaces = takeSpaces();
     auto lineBreaks = takeLineBreaks();
 
-    if ( myStream.eof() )
+    if ( atEnd() ) {
+        lexeme = myCursor;
         return TOK(EndOfFile);
+    }
 
     if ( lineBreaks ) {
         do {
@@ -290,77 +447,78 @@ Token Scanner::readNext()
             lineBreaks = takeLineBreaks();
         } while ( lineBreaks );
 
-        if ( myStream.eof() )
+        if ( atEnd() ) {
+            lexeme = myCursor;
             return TOK(EndOfFile);
+        }
 
-        return indent(myLine, myColumn, spaces);
+        return indent(spaces);
     }
-    else if ( spaces && column == 1 ) {
-        return indent(myLine, myColumn, spaces);
+    else if ( spaces && lineStart ) {
+        return indent(spaces);
     }
 
-    // Resync column with start of lexeme
-    column = myColumn;
+    // Resync with start of lexeme
+    lexeme = myCursor;
 
     if ( isIdentifierStart(c) ) {
-        do lexeme += nextChar();
-        while ( isIdentifierMid(peekChar()) );
+        myCursor = skipIdentifierMid(myCursor + 1, myEnd);
 
-        return Token(identifierKind(lexeme), myLine, column, lexeme);
+        std::string_view const id(lexeme, myCursor - lexeme);
+        auto const kind = identifierKind(id);
+        if ( kind != TokenKind::Identifier )
+            return token(kind, lexeme, myCursor);
+
+        return token(kind, lexeme, myCursor, myInterns.intern(id));
     }
     else if ( isFreeVariable(c) ) {
         nextChar();
         if ( !isLetter(peekChar()) )
-            return TOK2(Undefined, "\\");
+            return TOK(Undefined);
 
-        do lexeme += nextChar();
+        lexeme = myCursor;
+        do nextChar();
         while ( isLetter(peekChar()) || isNumber(peekChar()) );
 
-        return TOK(FreeVariable);
+        std::string_view const id(lexeme, myCursor - lexeme);
+        return token(TokenKind::FreeVariable, lexeme, myCursor, myInterns.intern(id));
     }
     else if ( isNumber(c) ) {
-        do lexeme += nextChar();
+        do nextChar();
         while ( isNumber(peekChar()) );
 
         if ( peekChar() == '.' ) {
-            c = nextChar();
+            nextChar();
             if ( !isNumber(peekChar()) ) {
-                myStream.unget();
+                ungetChar(); // .
 
                 return TOK(Integer);
             }
 
-            lexeme += '.';
-            do lexeme += nextChar();
+            do nextChar();
             while ( isNumber(peekChar()) );
 
             c = peekChar();
             if ( c == 'e' || c == 'E' ) {
-                char e = nextChar();
+                nextChar();
                 c = peekChar();
                 if ( !isNumber(c) ) {
                     if ( c != '-' && c != '+' ) {
-                        myStream.unget(); // e
+                        ungetChar(); // e
 
                         return TOK(Decimal);
                     }
 
-                    c = nextChar();
+                    nextChar();
                     if ( !isNumber(peekChar()) ) {
-                        myStream.unget(); // e
-                        myStream.unget(); // c
+                        ungetChar(); // c
+                        ungetChar(); // e
 
                         return TOK(Decimal);
                     }
-
-                    lexeme += e;
-                    lexeme += c;
-                }
-                else {
-                    lexeme += e;
                 }
 
-                do lexeme += nextChar();
+                do nextChar();
                 while ( isNumber(peekChar()) );
 
                 return TOK(Decimal);
@@ -371,85 +529,81 @@ Token Scanner::readNext()
 
         return TOK(Integer);
     }
-    else if ( c == '\'' ) {
-        do lexeme += nextChar();
-        while ( peekChar() != '\'' );
-
-        lexeme += nextChar();
+    else if ( c == '\'' || c == '"' ) {
+        do nextChar();
+        while ( !atEnd() && peekChar() != c );
 
-        return TOK(String);
-    }
-    else if ( c == '"' ) {
-        do lexeme += nextChar();
-        while ( peekChar() != '"' );
+        if ( atEnd() ) {
+            myError = true;
+            return TOK(Undefined);
+        }
 
-        lexeme += nextChar();
+        nextChar();
 
         return TOK(String);
     }
     else if ( c == '.' ) {
-        c = nextChar();
+        nextChar();
         if ( peekChar() == '.' ) {
-            c = nextChar();
+            nextChar();
 
-            return TOK2(Range, "..");
+            return TOK(Range);
         }
 
-        return TOK2(Dot, ".");
+        return TOK(Dot);
     }
     else if ( c == '=' ) {
-        c = nextChar();
+        nextChar();
 
         if ( peekChar() == '>' ) {
             nextChar();
 
-            return TOK2(Yield, "=>");
+            return TOK(Yield);
         }
 
-        return TOK2(Equal, "=");
+        return TOK(Equal);
     }
     else if ( c == ':' ) {
-        c = nextChar();
+        nextChar();
 
         if ( peekChar() == '|' ) {
             nextChar();
 
-            return TOK2(ColonPipe, ":|");
+            return TOK(ColonPipe);
         }
 
         if ( peekChar() == '&' ) {
             nextChar();
 
-            return TOK2(AmpersandPipe, ":&");
+            return TOK(AmpersandPipe);
         }
 
-        return TOK2(Colon, ":");
+        return TOK(Colon);
     }
 
     // Single characters
 
     c = nextChar();
     switch ( c ) {
-    case '(': return TOK2(OpenParen   , "(");
-    case ')': return TOK2(CloseParen  , ")");
-    case '[': return TOK2(OpenBracket , "[");
-    case ']': return TOK2(CloseBracket, "]");
-    case '<': return TOK2(OpenAngle   , "<");
-    case '>': return TOK2(CloseAngle  , ">");
-    case '{': return TOK2(OpenBrace   , "{");
-    case '}': return TOK2(CloseBrace  , "}");
-    case '|': return TOK2(Pipe        , "|");
-    case ',': return TOK2(Comma       , ",");
-    case '+': return TOK2(Plus        , "+");
-    case '-': return TOK2(Minus       , "-");
-    case '*': return TOK2(Star        , "*");
-    case '/': return TOK2(Slash       , "/");
+    case '(': return TOK(OpenParen   );
+    case ')': return TOK(CloseParen  );
+    case '[': return TOK(OpenBracket );
+    case ']': return TOK(CloseBracket);
+    case '<': return TOK(OpenAngle   );
+    case '>': return TOK(CloseAngle  );
+    case '{': return TOK(OpenBrace   );
+    case '}': return TOK(CloseBrace  );
+    case '|': return TOK(Pipe        );
+    case ',': return TOK(Comma       );
+    case '+': return TOK(Plus        );
+    case '-': return TOK(Minus       );
+    case '*': return TOK(Star        );
+    case '/': return TOK(Slash       );
     }
 
     myError = true;
-    return TOK2(Undefined, "");
+    return token(TokenKind::Undefined, lexeme, lexeme);
 
-#undef TOK2
 #undef TOK
 }
 
@@ -0,0 +1,218 @@
+#include <kyfoo/lexer/SourceBuffer.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+
+#include <kyfoo/lexer/CharScan.hpp>
+
+namespace fs = std::experimental::filesystem;
+
+namespace kyfoo {
+    namespace lexer {
+
+namespace
+{
+    constexpr std::size_t maxSources = std::size_t(std::numeric_limits<source_id_t>::max()) + 1;
+
+    // Lookups are lock-free; only id assignment takes the lock
+    std::atomic<SourceBuffer const*> theSources[maxSources];
+
+    // Released ids are reused only once every id has been handed out, oldest
+    // first, each time under a new generation
+    std::mutex theSourcesMutex;
+    std::deque<source_id_t> theFreeIds;
+    std::size_t theNextId = invalid_source_id + 1;
+    source_generation_t theGenerations[maxSources];
+
+    source_id_t acquireId(SourceBuffer const* source, source_generation_t& generation)
+    {
+        std::lock_guard<std::mutex> lock(theSourcesMutex);
+
+        source_id_t id;
+        if ( theNextId != maxSources ) {
+            id = static_cast<source_id_t>(theNextId++);
+        }
+        else {
+            if ( theFreeIds.empty() )
+                throw std::runtime_error("too many source buffers");
+
+            id = theFreeIds.front();
+            theFreeIds.pop_front();
+            ++theGenerations[id];
+        }
+
+        generation = theGenerations[id];
+        theSources[id].store(source, std::memory_order_release);
+        return id;
+    }
+
+    void releaseId(source_id_t id)
+    {
+        std::lock_guard<std::mutex> lock(theSourcesMutex);
+        theSources[id].store(nullptr, std::memory_order_release);
+        theFreeIds.push_back(id);
+    }
+}
+
+SourceBuffer::SourceBuffer(std::string&& text)
+    : myStorage(std::move(text))
+    , myText(myStorage)
+{
+    registerSelf();
+}
+
+SourceBuffer::SourceBuffer(std::string_view text)
+    : myText(text)
+{
+    registerSelf();
+}
+
+SourceBuffer::~SourceBuffer()
+{
+    releaseId(myId);
+}
+
+void SourceBuffer::registerSelf()
+{
+    if ( myText.size() > std::numeric_limits<source_offset_t>::max() )
+        throw std::length_error("source text is too large");
+
+    myId = acquireId(this, myGeneration);
+}
+
+std::unique_ptr<SourceBuffer> SourceBuffer::fromFile(fs::path const& path)
+{
+    std::ifstream fin(path, std::ios::in | std::ios::binary);
+    if ( !fin )
+        return nullptr;
+
+    // Read the whole file in one go; the scanner never touches the stream
+    std::string text;
+    fin.seekg(0, std::ios::end);
+    auto const size = fin.tellg();
+    if ( size > 0 ) {
+        text.resize(static_cast<std::size_t>(size));
+        fin.seekg(0, std::ios::beg);
+        fin.read(&text[0], size);
+        text.resize(static_cast<std::size_t>(fin.gcount()));
+    }
+
+    return std::make_unique<SourceBuffer>(std::move(text));
+}
+
+std::unique_ptr<SourceBuffer> SourceBuffer::fromStream(std::istream& stream)
+{
+    std::string text(std::istreambuf_iterator<char>(stream), {});
+    return std::make_unique<SourceBuffer>(std::move(text));
+}
+
+SourceBuffer const* SourceBuffer::find(source_id_t id, source_generation_t generation)
+{
+    auto const source = theSources[id].load(std::memory_order_acquire);
+    if ( source && source->myGeneration == generation )
+        return source;
+
+    return nullptr;
+}
+
+source_id_t SourceBuffer::id() const
+{
+    return myId;
+}
+
+source_generation_t SourceBuffer::generation() const
+{
+    return myGeneration;
+}
+
+char const* SourceBuffer::begin() const
+{
+    return myText.data();
+}
+
+char const* SourceBuffer::end() const
+{
+    return myText.data() + myText.size();
+}
+
+std::size_t SourceBuffer::size() const
+{
+    return myText.size();
+}
+
+std::string_view SourceBuffer::text() const
+{
+    return myText;
+}
+
+line_index_t SourceBuffer::line(source_offset_t offset) const
+{
+    auto const& source = resolve(offset);
+    if ( &source != this )
+        return source.line(offset);
+
+    auto const& starts = lineStarts();
+    return std::upper_bound(std::begin(starts), std::end(starts), offset) - std::begin(starts);
+}
+
+column_index_t SourceBuffer::column(source_offset_t offset) const
+{
+    auto const& source = resolve(offset);
+    if ( &source != this )
+        return source.column(offset);
+
+    auto const& starts = lineStarts();
+    auto l = std::upper_bound(std::begin(starts), std::end(starts), offset);
+    return offset - *(l - 1) + 1;
+}
+
+void SourceBuffer::forward(SourceBuffer const* target, std::vector<Relocation> relocations)
+{
+    std::sort(std::begin(relocations), std::end(relocations),
+              [](Relocation const& lhs, Relocation const& rhs) { return lhs.first < rhs.first; });
+
+    myTarget = target;
+    myRelocations = std::move(relocations);
+}
+
+SourceBuffer const& SourceBuffer::resolve(source_offset_t& offset) const
+{
+    if ( !myTarget )
+        return *this;
+
+    auto r = std::upper_bound(std::begin(myRelocations), std::end(myRelocations), offset,
+                              [](source_offset_t o, Relocation const& rhs) { return o < rhs.first; });
+    if ( r == std::begin(myRelocations) || offset >= (--r)->last )
+        return *this;
+
+    offset = offset - r->first + r->target;
+    return *myTarget;
+}
+
+std::vector<source_offset_t> const& SourceBuffer::lineStarts() const
+{
+    // Only diagnostics and dumps need positions, so build this on first use
+    std::call_once(myLineStartsFlag, [this] {
+        auto const first = begin();
+        auto const last = end();
+        myLineStarts.reserve(countNewlines(first, last) + 1);
+        myLineStarts.push_back(0);
+
+        for ( auto p = findLineBreak(first, last); p != last; p = findLineBreak(p, last) ) {
+            if ( *p++ == '\r' && p != last && *p == '\n' )
+                ++p;
+
+            myLineStarts.push_back(static_cast<source_offset_t>(p - first));
+        }
+    });
+
+    return myLineStarts;
+}
+
+    } // namespace lexer
+} // namespace kyfoo
@@ -1,85 +1,98 @@
 #include <kyfoo/lexer/Token.hpp>
 
+#include <stdexcept>
+
+#include <kyfoo/lexer/SourceBuffer.hpp>
+
 namespace kyfoo {
     namespace lexer {
 
-Token::Token()
+namespace
 {
+    SourceBuffer const* findSource(source_id_t id, source_generation_t generation)
+    {
+        if ( id == invalid_source_id )
+            return nullptr;
+
+        if ( auto src = SourceBuffer::find(id, generation) )
+            return src;
+
+        throw std::runtime_error("token outlived its source buffer");
+    }
 }
 
 Token::Token(TokenKind kind,
-             line_index_t line,
-             column_index_t column,
-             std::string const& lexeme)
-    : myKind(kind)
-    , myLine(line)
-    , myColumn(column)
-    , myLexeme(lexeme)
+             source_id_t source,
+             source_generation_t generation,
+             source_offset_t offset,
+             source_offset_t length,
+             intern_id_t id)
+    : myOffset(offset)
+    , myLength(length)
+    , myId(id)
+    , mySource(source)
+    , myKind(kind)
+    , myGeneration(generation)
 {
 }
 
-Token::Token(Token const& rhs)
-    : myKind(rhs.myKind)
-    , myLine(rhs.myLine)
-    , myColumn(rhs.myColumn)
-    , myLexeme(rhs.myLexeme)
+bool Token::operator < (Token const& rhs) const
 {
+    return myKind < rhs.myKind;
 }
 
-Token::Token(Token const&& rhs)
-    : myKind(rhs.myKind)
-    , myLine(rhs.myLine)
-    , myColumn(rhs.myColumn)
-    , myLexeme(rhs.myLexeme)
+Token::operator bool () const
 {
+    return myKind != TokenKind::Undefined;
 }
 
-Token& Token::operator = (Token const& rhs)
+TokenKind Token::kind() const
 {
-    if ( &rhs != this )
-        Token(rhs).swap(*this);
-    
-    return *this;
+    return myKind;
 }
 
-void Token::swap(Token& rhs)
+line_index_t Token::line() const
 {
-    using std::swap;
+    if ( auto src = findSource(mySource, myGeneration) )
+        return src->line(myOffset);
 
-    swap(myKind, rhs.myKind);
-    swap(myLine, rhs.myLine);
-    swap(myColumn, rhs.myColumn);
-    swap(myLexeme, rhs.myLexeme);
+    return 0;
 }
 
-bool Token::operator < (Token const& rhs) const
+column_index_t Token::column() const
 {
-    return myKind < rhs.myKind;
+    if ( auto src = findSource(mySource, myGeneration) )
+        return src->column(myOffset);
+
+    return 0;
 }
 
-Token::operator bool () const
+std::string_view Token::lexeme() const
 {
-    return myKind != TokenKind::Undefined;
+    if ( auto src = findSource(mySource, myGeneration) )
+        return src->text().substr(myOffset, myLength);
+
+    return std::string_view();
 }
 
-TokenKind Token::kind() const
+intern_id_t Token::id() const
 {
-    return myKind;
+    return myId;
 }
 
-line_index_t Token::line() const
+source_id_t Token::source() const
 {
-    return myLine;
+    return mySource;
 }
 
-column_index_t Token::column() const
+source_offset_t Token::offset() const
 {
-    return myColumn;
+    return myOffset;
 }
 
-std::string const& Token::lexeme() const
+source_offset_t Token::length() const
 {
-    return myLexeme;
+    return myLength;
 }
 
     } // namespace lexer
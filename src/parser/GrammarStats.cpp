@@ -0,0 +1,122 @@
+#include <kyfoo/parser/GrammarStats.hpp>
+
+#include <algorithm>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined(KYFOO_GRAMMAR_STATS) && defined(__GNUC__)
+#include <cstdlib>
+#include <cxxabi.h>
+#endif
+
+namespace kyfoo {
+    namespace parser {
+
+#ifdef KYFOO_GRAMMAR_STATS
+
+namespace
+{
+    struct Registry
+    {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<ProductionStats>> productions;
+    };
+
+    Registry& registry()
+    {
+        static Registry r;
+        return r;
+    }
+
+    std::string productionName(char const* name)
+    {
+#ifdef __GNUC__
+        int status = 0;
+        if ( auto demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status) ) {
+            std::string ret(demangled);
+            std::free(demangled);
+            return ret;
+        }
+#endif
+        return name;
+    }
+}
+
+ProductionStats& registerProduction(char const* name)
+{
+    auto& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.productions.emplace_back(std::make_unique<ProductionStats>(name));
+    return *r.productions.back();
+}
+
+bool grammarStatsEnabled()
+{
+    return true;
+}
+
+void resetGrammarStats()
+{
+    auto& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    for ( auto& p : r.productions ) {
+        p->attempts = 0;
+        p->successes = 0;
+        p->tokens = 0;
+        p->rollbacks = 0;
+    }
+}
+
+void printGrammarStats(std::ostream& stream)
+{
+    auto& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+
+    std::vector<ProductionStats const*> rows;
+    for ( auto const& p : r.productions )
+        if ( p->attempts )
+            rows.push_back(p.get());
+
+    std::stable_sort(begin(rows), end(rows), [](auto lhs, auto rhs) {
+        return lhs->attempts > rhs->attempts;
+    });
+
+    stream << std::setw(12) << "attempts"
+           << std::setw(12) << "successes"
+           << std::setw(12) << "rollbacks"
+           << std::setw(12) << "tokens"
+           << "  production\n";
+
+    for ( auto p : rows ) {
+        stream << std::setw(12) << p->attempts
+               << std::setw(12) << p->successes
+               << std::setw(12) << p->rollbacks
+               << std::setw(12) << p->tokens
+               << "  " << productionName(p->name) << '\n';
+    }
+}
+
+#else
+
+bool grammarStatsEnabled()
+{
+    return false;
+}
+
+void resetGrammarStats()
+{
+}
+
+void printGrammarStats(std::ostream& stream)
+{
+    stream << "grammar statistics require building with KYFOO_GRAMMAR_STATS\n";
+}
+
+#endif
+
+    } // namespace parser
+} // namespace kyfoo
@@ -2,11 +2,14 @@
 
 #include <filesystem>
 #include <fstream>
+#include <type_traits>
+#include <utility>
 
 #include <kyfoo/Diagnostics.hpp>
 #include <kyfoo/lexer/Token.hpp>
 #include <kyfoo/ast/Module.hpp>
 #include <kyfoo/ast/Scopes.hpp>
+#include <kyfoo/parser/ProductionsStatic.hpp>
 
 namespace fs = std::experimental::filesystem;
 
@@ -18,36 +21,39 @@ namespace kyfoo {
 
 DeclarationScopeParser::DeclarationScopeParser(ast::DeclarationScope* scope)
     : myScope(scope)
+    , myGrammar(scope->module()->moduleSet()->grammar())
 {
 }
 
 DeclarationScopeParser::~DeclarationScopeParser() = default;
 
-std::unique_ptr<ast::ImportDeclaration> parseImportDeclaration(lexer::Scanner& scanner)
+// Parses with whichever of the equivalent productions grammar selects
+template <typename Stateful, typename Stateless>
+auto parseProduction(lexer::Scanner& scanner, GrammarKind grammar)
 {
-    ImportDeclaration grammar;
-    if ( parse(scanner, grammar) )
-        return grammar.make();
+    if ( grammar == GrammarKind::Stateless )
+        return gs::parse<Stateless>(scanner);
 
-    return nullptr;
+    Stateful production;
+    if ( parse(scanner, production) )
+        return production.make();
+
+    return decltype(production.make())();
 }
 
-std::unique_ptr<ast::SymbolDeclaration> parseSymbolDeclaration(lexer::Scanner& scanner)
+std::unique_ptr<ast::ImportDeclaration> parseImportDeclaration(lexer::Scanner& scanner, GrammarKind grammar)
 {
-    SymbolDeclaration grammar;
-    if ( parse(scanner, grammar) )
-        return grammar.make();
-
-    return nullptr;
+    return parseProduction<ImportDeclaration, stateless::ImportDeclaration>(scanner, grammar);
 }
 
-std::unique_ptr<ast::Expression> parseExpression(lexer::Scanner& scanner)
+std::unique_ptr<ast::SymbolDeclaration> parseSymbolDeclaration(lexer::Scanner& scanner, GrammarKind grammar)
 {
-    Expression grammar;
-    if ( parse(scanner, grammar) )
-        return grammar.make();
+    return parseProduction<SymbolDeclaration, stateless::SymbolDeclaration>(scanner, grammar);
+}
 
-    return nullptr;
+std::unique_ptr<ast::Expression> parseExpression(lexer::Scanner& scanner, GrammarKind grammar)
+{
+    return parseProduction<Expression, stateless::Expression>(scanner, grammar);
 }
 
 std::unique_ptr<DataSumScopeParser>
@@ -90,7 +96,7 @@ DeclarationScopeParser::parseProcedureDefinition(Diagnostics& dgn,
         scanner.next(); // yield
         declaration.define(std::make_unique<ast::ProcedureScope>(myScope, declaration));
         if ( !isIndent(scanner.peek().kind()) ) {
-            auto expr = parseExpression(scanner);
+            auto expr = parseExpression(scanner, myGrammar);
             if ( !expr ) {
                 dgn.error(myScope->module(), scanner.peek()) << "expected expression following procedure declaration";
                 dgn.die();
@@ -113,84 +119,136 @@ DeclarationScopeParser::parseProcedureDefinition(Diagnostics& dgn,
 }
 
 std::unique_ptr<ast::DataSumDeclaration>
-parseDataSumDeclaration(lexer::Scanner& scanner)
+parseDataSumDeclaration(lexer::Scanner& scanner, GrammarKind grammar)
 {
-    DataSumDeclaration grammar;
-    if ( parse(scanner, grammar) )
-        return grammar.make();
-
-    return nullptr;
+    return parseProduction<DataSumDeclaration, stateless::DataSumDeclaration>(scanner, grammar);
 }
 
 std::unique_ptr<ast::DataSumDeclaration::Constructor>
-parseDataSumConstructor(lexer::Scanner& scanner)
+parseDataSumConstructor(lexer::Scanner& scanner, GrammarKind grammar)
 {
-    DataSumConstructor grammar;
-    if ( parse(scanner, grammar) )
-        return grammar.make();
-
-    return nullptr;
+    return parseProduction<DataSumConstructor, stateless::DataSumConstructor>(scanner, grammar);
 }
 
 std::unique_ptr<ast::DataProductDeclaration>
-parseDataProductDeclaration(lexer::Scanner& scanner)
+parseDataProductDeclaration(lexer::Scanner& scanner, GrammarKind grammar)
 {
-    DataProductDeclaration grammar;
-    if ( parse(scanner, grammar) )
-        return grammar.make();
-
-    return nullptr;
+    return parseProduction<DataProductDeclaration, stateless::DataProductDeclaration>(scanner, grammar);
 }
 
 std::unique_ptr<ast::VariableDeclaration>
-parseDataProductDeclarationField(lexer::Scanner& scanner)
+parseDataProductDeclarationField(lexer::Scanner& scanner, GrammarKind grammar)
 {
-    DataProductDeclarationField grammar;
-    if ( parse(scanner, grammar) )
-        return grammar.make();
-
-    return nullptr;
+    return parseProduction<DataProductDeclarationField, stateless::DataProductDeclarationField>(scanner, grammar);
 }
 
 std::unique_ptr<ast::ProcedureDeclaration>
-parseProcedureDeclaration(lexer::Scanner& scanner)
+parseProcedureDeclaration(lexer::Scanner& scanner, GrammarKind grammar)
+{
+    return parseProduction<ProcedureDeclaration, stateless::ProcedureDeclaration>(scanner, grammar);
+}
+
+namespace
 {
-    ProcedureDeclaration grammar;
-    if ( parse(scanner, grammar) ) {
-        return grammar.make();
+    // Tokens that can follow a declaration's leading identifier, either
+    // continuing its symbol or starting the rest of the declaration
+    template <typename T>
+    constexpr g::TokenSet afterName()
+    {
+        using rest_t = std::decay_t<decltype(std::declval<T const&>().template factor<1>())>;
+        return g::first<TupleSymbol>() | g::first<rest_t>();
     }
 
-    return nullptr;
+    constexpr auto importFirst = g::first<ImportDeclaration>();
+    constexpr auto dataSumFirst = g::first<DataSumDeclaration>();
+    constexpr auto dataProductFirst = g::first<DataProductDeclaration>();
+    constexpr auto symbolFirst = g::first<SymbolDeclaration>();
+    constexpr auto procedureFirst = g::first<ProcedureDeclaration>();
+
+    static_assert((importFirst & (dataSumFirst | dataProductFirst | symbolFirst | procedureFirst)).empty()
+               && (dataSumFirst & (dataProductFirst | symbolFirst | procedureFirst)).empty()
+               && (dataProductFirst & (symbolFirst | procedureFirst)).empty(),
+                  "declarations other than symbols and procedures must start differently");
+
+    static_assert(symbolFirst.contains(TokenKind::Identifier) && procedureFirst.contains(TokenKind::Identifier)
+               && !(afterName<SymbolDeclaration>() - afterName<ProcedureDeclaration>()).empty()
+               && !(afterName<ProcedureDeclaration>() - afterName<SymbolDeclaration>()).empty(),
+                  "symbol and procedure declarations are told apart after their name");
+
+    static_assert((g::first<DataProductDeclarationField>() & dataSumFirst).empty(),
+                  "data product fields and data sums must start differently");
+
+    // Both grammars are dispatched on the stateful productions' sets
+    template <typename Stateful, typename Stateless>
+    constexpr bool sameFirst()
+    {
+        return (g::first<Stateful>() - g::first<Stateless>()).empty()
+            && (g::first<Stateless>() - g::first<Stateful>()).empty();
+    }
+
+    static_assert(sameFirst<ImportDeclaration, stateless::ImportDeclaration>()
+               && sameFirst<DataSumDeclaration, stateless::DataSumDeclaration>()
+               && sameFirst<DataSumConstructor, stateless::DataSumConstructor>()
+               && sameFirst<DataProductDeclaration, stateless::DataProductDeclaration>()
+               && sameFirst<DataProductDeclarationField, stateless::DataProductDeclarationField>()
+               && sameFirst<SymbolDeclaration, stateless::SymbolDeclaration>()
+               && sameFirst<ProcedureDeclaration, stateless::ProcedureDeclaration>()
+               && sameFirst<Expression, stateless::Expression>(),
+                  "stateless productions must start like their stateful counterparts");
 }
 
 std::tuple<bool, std::unique_ptr<DeclarationScopeParser>>
 DeclarationScopeParser::parseNext(Diagnostics& dgn, lexer::Scanner& scanner)
 {
-    if ( auto importDecl = parseImportDeclaration(scanner) ) {
-        myScope->append(std::move(importDecl));
-        return std::make_tuple(true, nullptr);
-    }
-    else if ( auto symDecl = parseSymbolDeclaration(scanner) ) {
-        myScope->append(std::move(symDecl));
-        return std::make_tuple(true, nullptr);
+    // Only symbol and procedure declarations share a first token, and only
+    // a templated name leaves both possible after the second
+    auto const kind = scanner.peek().kind();
+    if ( importFirst.contains(kind) ) {
+        if ( auto importDecl = parseImportDeclaration(scanner, myGrammar) ) {
+            myScope->append(std::move(importDecl));
+            return std::make_tuple(true, nullptr);
+        }
     }
-    else if ( auto dsDecl = parseDataSumDeclaration(scanner) ) {
-        auto newScopeParser = parseDataSumDefinition(dgn, scanner, *dsDecl);
-        myScope->append(std::move(dsDecl));
+    else if ( dataSumFirst.contains(kind) ) {
+        if ( auto dsDecl = parseDataSumDeclaration(scanner, myGrammar) ) {
+            auto newScopeParser = parseDataSumDefinition(dgn, scanner, *dsDecl);
+            myScope->append(std::move(dsDecl));
 
-        return std::make_tuple(true, std::move(newScopeParser));
+            return std::make_tuple(true, std::move(newScopeParser));
+        }
     }
-    else if ( auto dpDecl = parseDataProductDeclaration(scanner) ) {
-        auto newScopeParser = parseDataProductDefinition(dgn, scanner, *dpDecl);
-        myScope->append(std::move(dpDecl));
+    else if ( dataProductFirst.contains(kind) ) {
+        if ( auto dpDecl = parseDataProductDeclaration(scanner, myGrammar) ) {
+            auto newScopeParser = parseDataProductDefinition(dgn, scanner, *dpDecl);
+            myScope->append(std::move(dpDecl));
 
-        return std::make_tuple(true, std::move(newScopeParser));
+            return std::make_tuple(true, std::move(newScopeParser));
+        }
     }
-    else if ( auto procDecl = parseProcedureDeclaration(scanner) ) {
-        auto newScopeParser = parseProcedureDefinition(dgn, scanner, *procDecl);
-        myScope->append(std::move(procDecl));
+    else {
+        auto symbol = symbolFirst.contains(kind);
+        auto procedure = procedureFirst.contains(kind);
+        if ( kind == TokenKind::Identifier ) {
+            auto const next = scanner.peek(1).kind();
+            symbol = afterName<SymbolDeclaration>().contains(next);
+            procedure = afterName<ProcedureDeclaration>().contains(next);
+        }
 
-        return std::make_tuple(true, std::move(newScopeParser));
+        if ( symbol ) {
+            if ( auto symDecl = parseSymbolDeclaration(scanner, myGrammar) ) {
+                myScope->append(std::move(symDecl));
+                return std::make_tuple(true, nullptr);
+            }
+        }
+
+        if ( procedure ) {
+            if ( auto procDecl = parseProcedureDeclaration(scanner, myGrammar) ) {
+                auto newScopeParser = parseProcedureDefinition(dgn, scanner, *procDecl);
+                myScope->append(std::move(procDecl));
+
+                return std::make_tuple(true, std::move(newScopeParser));
+            }
+        }
     }
 
     return std::make_tuple(false, nullptr);
@@ -233,7 +291,10 @@ DataSumScopeParser::~DataSumScopeParser() = default;
 std::tuple<bool, std::unique_ptr<DeclarationScopeParser>>
 DataSumScopeParser::parseNext(Diagnostics& /*dgn*/, lexer::Scanner& scanner)
 {
-    if ( auto dsCtor = parseDataSumConstructor(scanner) ) {
+    if ( !g::first<DataSumConstructor>().contains(scanner.peek().kind()) )
+        return std::make_tuple(false, nullptr);
+
+    if ( auto dsCtor = parseDataSumConstructor(scanner, myGrammar) ) {
         dsCtor->setParent(scope()->declaration()->as<ast::DataSumDeclaration>());
         myScope->append(std::move(dsCtor));
         return std::make_tuple(true, nullptr);
@@ -260,15 +321,20 @@ DataProductScopeParser::~DataProductScopeParser() = default;
 std::tuple<bool, std::unique_ptr<DeclarationScopeParser>>
 DataProductScopeParser::parseNext(Diagnostics& dgn, lexer::Scanner& scanner)
 {
-    if ( auto field = parseDataProductDeclarationField(scanner) ) {
-        myScope->append(std::move(field));
-        return std::make_tuple(true, nullptr);
+    auto const kind = scanner.peek().kind();
+    if ( g::first<DataProductDeclarationField>().contains(kind) ) {
+        if ( auto field = parseDataProductDeclarationField(scanner, myGrammar) ) {
+            myScope->append(std::move(field));
+            return std::make_tuple(true, nullptr);
+        }
     }
-    else if ( auto dsDecl = parseDataSumDeclaration(scanner) ) {
-        auto newScopeParser = parseDataSumDefinition(dgn, scanner, *dsDecl);
-        myScope->append(std::move(dsDecl));
+    else if ( dataSumFirst.contains(kind) ) {
+        if ( auto dsDecl = parseDataSumDeclaration(scanner, myGrammar) ) {
+            auto newScopeParser = parseDataSumDefinition(dgn, scanner, *dsDecl);
+            myScope->append(std::move(dsDecl));
 
-        return std::make_tuple(true, std::move(newScopeParser));
+            return std::make_tuple(true, std::move(newScopeParser));
+        }
     }
 
     return std::make_tuple(false, nullptr);
@@ -299,7 +365,10 @@ ProcedureScopeParser::parseNext(Diagnostics& dgn, lexer::Scanner& scanner)
             return declParse;
     }
 
-    auto expr = parseExpression(scanner);
+    if ( !g::first<Expression>().contains(scanner.peek().kind()) )
+        return std::make_tuple(false, nullptr);
+
+    auto expr = parseExpression(scanner, myGrammar);
     if ( expr ) {
         scope()->append(std::move(expr));
         return std::make_tuple(true, nullptr);
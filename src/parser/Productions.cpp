@@ -36,22 +36,39 @@ struct Expression::impl : public
 
 Expression::Expression() = default;
 
-Expression::Expression(Expression const& rhs)
-    : myGrammar(rhs.myGrammar ? std::make_unique<impl>(*rhs.myGrammar) : nullptr)
-{
-}
+Expression::Expression(Expression const& rhs) = default;
 
 Expression::~Expression() = default;
 
 bool Expression::match(kyfoo::lexer::ScanPoint scan, std::size_t& matches)
 {
-    if ( !myGrammar )
-        myGrammar = std::make_unique<impl>();
+    // Tuple alternatives and repeats revisit the same positions, and each
+    // nested expression would otherwise be parsed again every time
+    static char const production = 0;
+    if ( auto memo = scan.recall(&production) ) {
+        if ( !memo->capture )
+            return false;
 
-    if ( myGrammar->match(scan, matches) )
+        myGrammar = static_cast<impl const*>(memo->capture);
+        scan.skip(memo->length);
+        matches += memo->length;
         return scan.commit();
+    }
+
+    auto const position = scan.position();
+    auto const mark = scan.captures().mark();
+    auto grammar = scan.captures().create<impl>();
+    std::size_t m = 0;
+    if ( !grammar->match(scan, m) ) {
+        scan.release(mark);
+        scan.remember(&production, position, lexer::ScanMemo());
+        return false;
+    }
 
-    return false;
+    scan.remember(&production, position, lexer::ScanMemo{ scan.position() - position, grammar });
+    myGrammar = grammar;
+    matches += m;
+    return scan.commit();
 }
 
 std::unique_ptr<ast::Expression> Expression::make() const
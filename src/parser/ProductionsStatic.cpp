@@ -0,0 +1,71 @@
+#include <kyfoo/parser/ProductionsStatic.hpp>
+
+namespace kyfoo {
+    namespace parser {
+        namespace stateless {
+
+//
+// Expression
+
+struct Expression::impl : public
+    gs::And<gs::OneOrMore<gs::Or<Tuple, Primary>>, gs::Opt<gs::And<colon, Expression>>>
+{
+    static std::unique_ptr<ast::Expression> make(gs::Reader& reader)
+    {
+        std::vector<std::unique_ptr<ast::Expression>> exprs;
+        gs::OneOrMore<gs::Or<Tuple, Primary>>::each(reader, [&exprs](gs::Reader& r) {
+            if ( gs::Or<Tuple, Primary>::index(r) == 0 )
+                exprs.emplace_back(Tuple::make(r));
+            else
+                exprs.emplace_back(Primary::make(r));
+        });
+
+        std::unique_ptr<ast::Expression> subject;
+        if ( exprs.size() == 1 )
+            subject = std::move(exprs.front());
+        else
+            subject = std::make_unique<ast::ApplyExpression>(std::move(exprs));
+
+        if ( gs::Opt<gs::And<colon, Expression>>::present(reader) ) {
+            reader.token();
+            subject->addConstraint(Expression::make(reader));
+        }
+
+        return subject;
+    }
+};
+
+bool Expression::match(gs::Trace& trace, lexer::ScanPoint scan)
+{
+    // Memoized as in the stateful grammar, keeping a copy of what the match
+    // recorded in the scanner's capture arena
+    static char const production = 0;
+    if ( auto memo = scan.recall(&production) ) {
+        if ( !memo->capture )
+            return false;
+
+        trace.append(*static_cast<gs::Trace const*>(memo->capture));
+        scan.skip(memo->length);
+        return scan.commit();
+    }
+
+    auto const position = scan.position();
+    auto const mark = trace.mark();
+    if ( !impl::match(trace, scan) ) {
+        scan.remember(&production, position, lexer::ScanMemo());
+        return false;
+    }
+
+    auto recorded = scan.captures().create<gs::Trace>(trace.since(mark));
+    scan.remember(&production, position, lexer::ScanMemo{ scan.position() - position, recorded });
+    return scan.commit();
+}
+
+std::unique_ptr<ast::Expression> Expression::make(gs::Reader& reader)
+{
+    return impl::make(reader);
+}
+
+        } // namespace stateless
+    } // namespace parser
+} // namespace kyfoo